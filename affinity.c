@@ -0,0 +1,161 @@
+// Thread placement planning.
+//
+// Turns an enumerated topology and a thread count into a list of OS CPU IDs,
+// one per thread, plus the SMT siblings of the chosen cores that should stay
+// idle. Every policy is an ordering of the logical CPUs, and a plan is the
+// first threadCount CPUs of that order:
+//
+//   PHYSICAL_CORES  one CPU per core, cores of one L3 domain next to each other
+//   COMPACT         fill one L3 domain at a time, its cores before their siblings
+//   SPREAD          alternate packages, all cores before any sibling
+//
+// Requires cpuid.c and topology.c to be included first.
+
+enum X64PlacementPolicy {
+    X64_PLACEMENT_PHYSICAL_CORES    = 0,
+    X64_PLACEMENT_COMPACT           = 1,
+    X64_PLACEMENT_SPREAD            = 2,
+};
+
+struct X64PlacementPlan {
+    // May be smaller than requested if the policy ran out of CPUs
+    uint32_t            threadCount;
+    // OS CPU ID for each thread
+    uint32_t            cpus[X64_MAX_CPUS];
+    // Siblings of the chosen cores that no thread runs on
+    struct X64CpuMask   idleSiblings;
+};
+
+struct X64PlacementSlot {
+    uint32_t    osCpuId;
+    uint32_t    packageId;
+    uint32_t    l3Id;
+    uint32_t    coreKey;
+    uint32_t    smtId;
+    // 0 for the first CPU of a core, 1 for its first sibling and so on
+    uint32_t    rank;
+    // Position of the core among the cores of its package
+    uint32_t    coreIndex;
+};
+
+#define X64_COMPARE_FIELD(a, b, field) \
+    if ((a)->field != (b)->field) return (a)->field < (b)->field ? -1 : 1;
+
+static int x64CompareByCore(const void* x, const void* y) {
+    const struct X64PlacementSlot* a = x;
+    const struct X64PlacementSlot* b = y;
+    X64_COMPARE_FIELD(a, b, packageId);
+    X64_COMPARE_FIELD(a, b, l3Id);
+    X64_COMPARE_FIELD(a, b, coreKey);
+    X64_COMPARE_FIELD(a, b, smtId);
+    return 0;
+}
+
+static int x64CompareCompact(const void* x, const void* y) {
+    const struct X64PlacementSlot* a = x;
+    const struct X64PlacementSlot* b = y;
+    X64_COMPARE_FIELD(a, b, packageId);
+    X64_COMPARE_FIELD(a, b, l3Id);
+    X64_COMPARE_FIELD(a, b, rank);
+    X64_COMPARE_FIELD(a, b, coreKey);
+    return 0;
+}
+
+static int x64CompareSpread(const void* x, const void* y) {
+    const struct X64PlacementSlot* a = x;
+    const struct X64PlacementSlot* b = y;
+    X64_COMPARE_FIELD(a, b, rank);
+    X64_COMPARE_FIELD(a, b, coreIndex);
+    X64_COMPARE_FIELD(a, b, packageId);
+    return 0;
+}
+
+// Fills plan for threadCount threads. Returns false if no CPU could be
+// assigned or memory ran out
+bool x64PlanPlacement(const struct X64Topology* topology, enum X64PlacementPolicy policy,
+                      uint32_t threadCount, struct X64PlacementPlan* plan) {
+    *plan = (struct X64PlacementPlan){};
+    if (topology->cpuCount == 0) {
+        return false;
+    }
+
+    struct X64PlacementSlot* slots = calloc(topology->cpuCount, sizeof(struct X64PlacementSlot));
+    if (!slots) {
+        return false;
+    }
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        const struct X64LogicalCpu* cpu = &topology->cpus[i];
+        slots[i].osCpuId = cpu->osCpuId;
+        slots[i].packageId = cpu->packageId;
+        slots[i].l3Id = cpu->l3Id;
+        slots[i].coreKey = topology->smtShift >= 32 ? 0 : cpu->x2ApicId >> topology->smtShift;
+        slots[i].smtId = cpu->smtId;
+    }
+
+    // Rank the CPUs of each core and number the cores of each package
+    qsort(slots, topology->cpuCount, sizeof(struct X64PlacementSlot), x64CompareByCore);
+    uint32_t coreIndex = 0;
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        if (i == 0 || slots[i].packageId != slots[i - 1].packageId) {
+            coreIndex = 0;
+        } else if (slots[i].coreKey != slots[i - 1].coreKey) {
+            coreIndex++;
+        }
+        slots[i].rank = i > 0 && slots[i].coreKey == slots[i - 1].coreKey ? slots[i - 1].rank + 1 : 0;
+        slots[i].coreIndex = coreIndex;
+    }
+
+    switch (policy) {
+    case X64_PLACEMENT_COMPACT:
+        qsort(slots, topology->cpuCount, sizeof(struct X64PlacementSlot), x64CompareCompact);
+        break;
+    case X64_PLACEMENT_SPREAD:
+        qsort(slots, topology->cpuCount, sizeof(struct X64PlacementSlot), x64CompareSpread);
+        break;
+    default:
+        // Already ordered by L3 domain and core
+        break;
+    }
+
+    struct X64CpuMask usedCores = {};
+    for (uint32_t i = 0; i < topology->cpuCount && plan->threadCount < threadCount; i++) {
+        if (policy == X64_PLACEMENT_PHYSICAL_CORES && slots[i].rank != 0) {
+            continue;
+        }
+        plan->cpus[plan->threadCount++] = slots[i].osCpuId;
+        // A core is marked by the OS ID of its first CPU, which every policy
+        // assigns before the siblings of that core
+        if (slots[i].rank == 0) {
+            x64CpuMaskSet(&usedCores, slots[i].osCpuId);
+        }
+    }
+
+    // Siblings of used cores that did not get a thread stay idle
+    qsort(slots, topology->cpuCount, sizeof(struct X64PlacementSlot), x64CompareByCore);
+    struct X64CpuMask assigned = {};
+    for (uint32_t t = 0; t < plan->threadCount; t++) {
+        x64CpuMaskSet(&assigned, plan->cpus[t]);
+    }
+    uint32_t coreFirstCpu = 0;
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        if (slots[i].rank == 0) {
+            coreFirstCpu = slots[i].osCpuId;
+            continue;
+        }
+        if (x64CpuMaskHas(&usedCores, coreFirstCpu) && !x64CpuMaskHas(&assigned, slots[i].osCpuId)) {
+            x64CpuMaskSet(&plan->idleSiblings, slots[i].osCpuId);
+        }
+    }
+
+    free(slots);
+    return plan->threadCount > 0;
+}
+
+const char* x64PlacementPolicyName(enum X64PlacementPolicy policy) {
+    switch (policy) {
+    case X64_PLACEMENT_PHYSICAL_CORES:  return "physical";
+    case X64_PLACEMENT_COMPACT:         return "compact";
+    case X64_PLACEMENT_SPREAD:          return "spread";
+    default:                            return "unknown";
+    }
+}
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "cpuid.c"
+#include "dump.c"
+#include <dirent.h>
+#include <pthread.h>
+
+// Fleet aggregation over a directory of per-host captures written by
+// `cpuid --dump`. Files are handed out one at a time to a pool of workers,
+// each of which keeps only fixed size counters, so memory stays bounded no
+// matter how many hosts the directory holds.
+
+#define AGG_MAX_WORKERS         64
+#define AGG_MAX_LEVELS          5
+// Example hosts kept per microarchitecture level
+#define AGG_MAX_EXAMPLES        16
+#define AGG_MAX_HOST_NAME       256
+
+struct AggState;
+
+struct AggWorker {
+    pthread_t               thread;
+    struct AggState*        state;
+    uint64_t                hostCount;
+    uint64_t                invalidCount;
+    uint32_t                featureCounts[X64_FEATURE_BITS];
+    uint64_t                levelCounts[AGG_MAX_LEVELS];
+    uint32_t                exampleCounts[AGG_MAX_LEVELS];
+    char                    examples[AGG_MAX_LEVELS][AGG_MAX_EXAMPLES][AGG_MAX_HOST_NAME];
+};
+
+struct AggState {
+    const char*             path;
+    DIR*                    dir;
+    pthread_mutex_t         dirLock;
+    struct AggWorker        workers[AGG_MAX_WORKERS];
+};
+
+// Returns false once the directory is exhausted
+static bool aggNextFile(struct AggState* state, char* name) {
+    bool found = false;
+    pthread_mutex_lock(&state->dirLock);
+    struct dirent* entry;
+    while ((entry = readdir(state->dir)) != 0) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(name, AGG_MAX_HOST_NAME, "%s", entry->d_name);
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&state->dirLock);
+    return found;
+}
+
+static void aggAddHost(struct AggWorker* worker, const char* name, const struct X64Info* cpuid) {
+    worker->hostCount++;
+
+    const uint64_t* words = cpuid->features.words;
+    for (uint32_t w = 0; w < X64_FEATURE_WORDS; w++) {
+        uint64_t bits = words[w];
+        while (bits) {
+            worker->featureCounts[w * 64 + __builtin_ctzll(bits)]++;
+            bits &= bits - 1;
+        }
+    }
+
+    uint32_t level = x64GetMicroarchLevel(cpuid);
+    worker->levelCounts[level]++;
+    if (worker->exampleCounts[level] < AGG_MAX_EXAMPLES) {
+        snprintf(worker->examples[level][worker->exampleCounts[level]++], AGG_MAX_HOST_NAME, "%s", name);
+    }
+}
+
+static void* aggWorkerMain(void* arg) {
+    struct AggWorker* worker = arg;
+    struct AggState* state = worker->state;
+
+    char name[AGG_MAX_HOST_NAME];
+    char path[4096];
+    while (aggNextFile(state, name)) {
+        snprintf(path, sizeof(path), "%s/%s", state->path, name);
+
+        struct X64CpuidDump dump;
+        if (!x64OpenCpuidDump(path, &dump)) {
+            worker->invalidCount++;
+            continue;
+        }
+
+        struct X64CpuidBackend backend;
+        struct X64Info cpuid;
+        x64DumpBackend(&dump, &backend);
+        getCpuidInfoFromBackend(&backend, &cpuid);
+        x64CloseCpuidDump(&dump);
+
+        aggAddHost(worker, name, &cpuid);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("Usage: %s <capture directory>\n", argv[0]);
+        return 1;
+    }
+
+    static struct AggState state;
+    state.path = argv[1];
+    state.dir = opendir(state.path);
+    if (!state.dir) {
+        printf("Cannot open %s\n", state.path);
+        return 1;
+    }
+    pthread_mutex_init(&state.dirLock, 0);
+
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t workerCount = cpuCount < 1 ? 1 : cpuCount > AGG_MAX_WORKERS ? AGG_MAX_WORKERS : (uint32_t)cpuCount;
+    uint32_t startedCount = 0;
+    while (startedCount < workerCount) {
+        struct AggWorker* worker = &state.workers[startedCount];
+        worker->state = &state;
+        if (pthread_create(&worker->thread, 0, aggWorkerMain, worker) != 0) {
+            break;
+        }
+        startedCount++;
+    }
+
+    // Merge the per worker counters into the first worker. Without any thread
+    // the first worker runs here instead
+    struct AggWorker* total = &state.workers[0];
+    if (startedCount == 0) {
+        aggWorkerMain(total);
+    } else {
+        pthread_join(total->thread, 0);
+    }
+    for (uint32_t i = 1; i < startedCount; i++) {
+        struct AggWorker* worker = &state.workers[i];
+        pthread_join(worker->thread, 0);
+
+        total->hostCount += worker->hostCount;
+        total->invalidCount += worker->invalidCount;
+        for (uint32_t f = 0; f < X64_FEATURE_BITS; f++) {
+            total->featureCounts[f] += worker->featureCounts[f];
+        }
+        for (uint32_t level = 0; level < AGG_MAX_LEVELS; level++) {
+            total->levelCounts[level] += worker->levelCounts[level];
+            for (uint32_t e = 0; e < worker->exampleCounts[level] && total->exampleCounts[level] < AGG_MAX_EXAMPLES; e++) {
+                memcpy(total->examples[level][total->exampleCounts[level]++], worker->examples[level][e], AGG_MAX_HOST_NAME);
+            }
+        }
+    }
+    closedir(state.dir);
+
+    printf("Hosts: %llu", (unsigned long long)total->hostCount);
+    if (total->invalidCount) {
+        printf(" (%llu files skipped, not CPUID captures)", (unsigned long long)total->invalidCount);
+    }
+    printf("\n\n");
+    if (total->hostCount == 0) {
+        return 1;
+    }
+
+    printf("Feature coverage:\n");
+    for (uint32_t f = 0; f < X64_FEATURE_BITS; f++) {
+        if (total->featureCounts[f] == 0 || !x64FeatureNames[f]) {
+            continue;
+        }
+        printf("\t%-22s %10u  %6.2f%%\n", x64FeatureNames[f], total->featureCounts[f],
+                100.0 * total->featureCounts[f] / total->hostCount);
+    }
+
+    uint32_t baseline = AGG_MAX_LEVELS - 1;
+    uint32_t majority = 0;
+    printf("\nMicroarchitecture levels:\n");
+    for (uint32_t level = 0; level < AGG_MAX_LEVELS; level++) {
+        if (total->levelCounts[level] == 0) {
+            continue;
+        }
+        if (level < baseline) {
+            baseline = level;
+        }
+        if (total->levelCounts[level] > total->levelCounts[majority]) {
+            majority = level;
+        }
+        printf("\tx86-64-v%u: %llu\n", level, (unsigned long long)total->levelCounts[level]);
+    }
+
+    if (baseline == 0) {
+        printf("\nSafe baseline: none, some hosts lack the x86-64 baseline\n");
+    } else if (baseline == 1) {
+        printf("\nSafe baseline: -march=x86-64\n");
+    } else {
+        printf("\nSafe baseline: -march=x86-64-v%u\n", baseline);
+    }
+
+    // Hosts below the level most of the fleet supports are what hold the baseline down
+    for (uint32_t level = baseline; level < majority; level++) {
+        if (total->levelCounts[level] == 0) {
+            continue;
+        }
+        printf("Hosts at x86-64-v%u, below the majority level v%u (%llu total, showing %u):\n",
+                level, majority, (unsigned long long)total->levelCounts[level], total->exampleCounts[level]);
+        for (uint32_t e = 0; e < total->exampleCounts[level]; e++) {
+            printf("\t%s\n", total->examples[level][e]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+#include "cpuid.c"
+
+// Measures the cost of executeCpuidWithSubleaf() for every supported leaf and
+// subleaf. Each sample is bracketed by LFENCE+RDTSC and RDTSCP+LFENCE so the
+// CPUID cannot be reordered out of the timed region. Without RDTSCP the end is
+// bracketed by LFENCE+RDTSC+LFENCE instead.
+
+#define BENCH_SAMPLES       1000
+
+struct BenchLeaf {
+    uint32_t leaf;
+    uint32_t subleaf;
+};
+
+static bool             benchHasRdtscp;
+static struct BenchLeaf benchLeaves[1024];
+static uint32_t         benchLeafCount;
+
+static void benchAddLeaf(uint32_t leaf, uint32_t subleaf) {
+    if (benchLeafCount < sizeof(benchLeaves) / sizeof(benchLeaves[0])) {
+        benchLeaves[benchLeafCount].leaf = leaf;
+        benchLeaves[benchLeafCount].subleaf = subleaf;
+        benchLeafCount++;
+    }
+}
+
+static void benchAddRange(uint32_t firstLeaf, uint32_t lastLeaf) {
+    for (uint32_t leaf = firstLeaf; leaf <= lastLeaf; leaf++) {
+        uint32_t subleafCount = x64GetSubleafCount(&x64NativeBackend, leaf);
+        for (uint32_t subleaf = 0; subleaf < subleafCount; subleaf++) {
+            benchAddLeaf(leaf, subleaf);
+        }
+    }
+}
+
+static inline uint64_t benchStart() {
+    _mm_lfence();
+    uint64_t tsc = __rdtsc();
+    _mm_lfence();
+    return tsc;
+}
+
+static inline uint64_t benchEnd() {
+    uint64_t tsc;
+    if (benchHasRdtscp) {
+        uint32_t aux;
+        tsc = __rdtscp(&aux);
+    } else {
+        // RDTSC alone may execute before the timed instructions complete
+        _mm_lfence();
+        tsc = __rdtsc();
+    }
+    _mm_lfence();
+    return tsc;
+}
+
+static int benchCompareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void benchReport(const char* label, uint64_t* samples) {
+    qsort(samples, BENCH_SAMPLES, sizeof(uint64_t), benchCompareU64);
+    printf("%-24s %10llu %10llu %10llu\n", label,
+            (unsigned long long)samples[0],
+            (unsigned long long)samples[BENCH_SAMPLES / 2],
+            (unsigned long long)samples[BENCH_SAMPLES * 99 / 100]);
+}
+
+int main() {
+    if (!x64InitCpuidCache()) {
+        printf("This CPU does not support CPUID\n");
+        return 1;
+    }
+    const struct X64Info* cpuid = x64Cpu();
+    benchHasRdtscp = x64FeatureSetHas(&cpuid->features, X64_FEATURE_RDTSCP);
+
+    if (cpuid->hypervisor != X64_HYPERVISOR_NONE) {
+        printf("Environment: hypervisor %s \"%s\"\n", x64HypervisorName(cpuid->hypervisor), cpuid->hypervisorVendor);
+    } else {
+        printf("Environment: bare metal\n");
+    }
+    printf("Samples per leaf: %u, values in TSC cycles\n\n", BENCH_SAMPLES);
+
+    benchAddRange(0, cpuid->maxInputBasicInfo);
+    if (cpuid->hasExtendedInfo) {
+        benchAddRange(0x80000000, cpuid->maxExtendedLeaf);
+    }
+    if (cpuid->hypervisorMaxLeaf >= 0x40000000 && cpuid->hypervisorMaxLeaf < 0x40000100) {
+        benchAddRange(0x40000000, cpuid->hypervisorMaxLeaf);
+    }
+
+    static uint64_t samples[BENCH_SAMPLES];
+    printf("%-24s %10s %10s %10s\n", "Leaf", "min", "median", "p99");
+
+    // Cost of the timing brackets alone, to be subtracted mentally from the rows below
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = benchStart();
+        samples[i] = benchEnd() - start;
+    }
+    benchReport("(timer overhead)", samples);
+
+    for (uint32_t l = 0; l < benchLeafCount; l++) {
+        struct BenchLeaf* leaf = &benchLeaves[l];
+        for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+            struct X64CpuidResult result;
+            uint64_t start = benchStart();
+            executeCpuidWithSubleaf(leaf->leaf, leaf->subleaf, &result);
+            samples[i] = benchEnd() - start;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "0x%08x.%u", leaf->leaf, leaf->subleaf);
+        benchReport(label, samples);
+    }
+
+    return 0;
+}
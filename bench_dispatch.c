@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpuid.c"
+#include "dispatch.c"
+#include "kernels.c"
+
+#define BENCH_BUFFER_SIZE   (64 * 1024)
+#define BENCH_MIN_SECONDS   0.2
+
+static double benchNow() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Keeps results alive so the kernels are not optimized away
+static volatile uint64_t benchSink;
+
+static uint8_t benchBytes[BENCH_BUFFER_SIZE];
+static float   benchA[BENCH_BUFFER_SIZE / sizeof(float)];
+static float   benchB[BENCH_BUFFER_SIZE / sizeof(float)];
+
+static void benchCrc32c(X64DispatchFn fn) {
+    benchSink += ((X64Crc32cFn)fn)(0, benchBytes, BENCH_BUFFER_SIZE);
+}
+
+static void benchMemchr(X64DispatchFn fn) {
+    benchSink += (uintptr_t)((X64MemchrFn)fn)(benchBytes, 0xFF, BENCH_BUFFER_SIZE);
+}
+
+static void benchDotProduct(X64DispatchFn fn) {
+    benchSink += (uint64_t)((X64DotProductFn)fn)(benchA, benchB, BENCH_BUFFER_SIZE / sizeof(float));
+}
+
+struct BenchKernel {
+    const char* name;
+    void        (*runOnce)(X64DispatchFn fn);
+};
+
+static const struct BenchKernel benchKernels[] = {
+    { "crc32c",         benchCrc32c },
+    { "memchr",         benchMemchr },
+    { "dot_product",    benchDotProduct },
+};
+
+// Runs one variant repeatedly over the benchmark buffer and returns GB/s
+static double benchVariant(const struct BenchKernel* kernel, X64DispatchFn fn) {
+    uint64_t iterations = 0;
+    double start = benchNow();
+    double elapsed = 0;
+    do {
+        for (uint32_t i = 0; i < 64; i++) {
+            kernel->runOnce(fn);
+        }
+        iterations += 64;
+        elapsed = benchNow() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    return (double)iterations * BENCH_BUFFER_SIZE / elapsed / 1e9;
+}
+
+int main() {
+    if (!x64InitCpuidCache()) {
+        printf("This CPU does not support CPUID\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < BENCH_BUFFER_SIZE; i++) {
+        // memchr searches for 0xFF, which never occurs, so every variant scans the whole buffer
+        benchBytes[i] = (uint8_t)(i % 251);
+    }
+    for (uint32_t i = 0; i < BENCH_BUFFER_SIZE / sizeof(float); i++) {
+        benchA[i] = (float)(i % 17) * 0.25f;
+        benchB[i] = (float)(i % 13) * 0.5f;
+    }
+
+    x64InitKernels();
+    enum X64IsaLevel isaLevel = x64GetIsaLevel(x64Cpu());
+    printf("ISA level: %s\n", x64IsaLevelName(isaLevel));
+    printf("Buffer size: %u KB\n\n", BENCH_BUFFER_SIZE / 1024);
+
+    uint32_t dispatcherCount = 0;
+    const struct X64Dispatcher* dispatchers = x64GetDispatchers(&dispatcherCount);
+    for (uint32_t d = 0; d < dispatcherCount; d++) {
+        const struct X64Dispatcher* dispatcher = &dispatchers[d];
+        const struct BenchKernel* kernel = 0;
+        for (uint32_t k = 0; k < X64_ARRAY_COUNT(benchKernels); k++) {
+            if (strcmp(benchKernels[k].name, dispatcher->name) == 0) {
+                kernel = &benchKernels[k];
+            }
+        }
+        if (!kernel) {
+            continue;
+        }
+        printf("%s:\n", dispatcher->name);
+
+        for (uint32_t v = 0; v < dispatcher->variantCount; v++) {
+            const struct X64DispatchVariant* variant = &dispatcher->variants[v];
+            if (variant->level > isaLevel) {
+                printf("\t%-8s    unsupported\n", variant->name);
+                continue;
+            }
+
+            double gbPerSecond = benchVariant(kernel, variant->fn);
+            printf("\t%-8s %8.2f GB/s%s\n", variant->name, gbPerSecond,
+                    variant == dispatcher->selected ? "  (selected)" : "");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "cpuid.c"
+#include "tsc.c"
+
+// Measures load latency and read bandwidth with working sets just below and
+// just above every data cache level CPUID reports, then checks that the
+// measured boundaries line up with the reported sizes.
+//
+// Latency is a dependent pointer chase through the lines of the working set in
+// random order, so neither the prefetchers nor out of order execution can hide
+// it. Bandwidth is a streaming sum over the same buffer. The buffer is backed
+// by huge pages where possible so TLB misses do not blur the cache steps.
+
+#define BENCH_MIN_NS            100000000ull
+#define BENCH_CHASE_CHUNK       (1u << 16)
+#define BENCH_MAX_BUFFER        (1ull << 30)
+// Working sets relative to each cache size, in percent
+#define BENCH_BELOW_PERCENT     75
+#define BENCH_ABOVE_PERCENT     150
+// A level boundary is considered visible when latency grows by this factor
+#define BENCH_STEP_FACTOR       1.5
+
+struct BenchPoint {
+    const struct X64CacheInfo*  cache;
+    size_t                      bytes;
+    double                      latencyNs;
+    double                      gbPerSecond;
+};
+
+static struct X64TscClock  benchClock;
+// Keeps results alive so the loops are not optimized away
+static volatile uint64_t   benchSink;
+
+// The MSVC UCRT has no aligned_alloc, and its aligned blocks need their own free
+static void* benchAllocAligned(size_t alignment, size_t bytes) {
+#ifdef _WIN32
+    return _aligned_malloc(bytes, alignment);
+#else
+    return aligned_alloc(alignment, bytes);
+#endif
+}
+
+static void benchFreeAligned(void* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+static uint64_t benchRandom(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Links the first pointer of every line in bytes into one random cycle
+static void benchBuildChain(uint8_t* buffer, size_t bytes, uint32_t lineSize, uint32_t* order) {
+    const size_t lines = bytes / lineSize;
+    for (size_t i = 0; i < lines; i++) {
+        order[i] = (uint32_t)i;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = lines - 1; i > 0; i--) {
+        size_t j = benchRandom(&state) % (i + 1);
+        uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        void** line = (void**)&buffer[(size_t)order[i] * lineSize];
+        *line = &buffer[(size_t)order[(i + 1) % lines] * lineSize];
+    }
+}
+
+// Nanoseconds per dependent load
+static double benchLatency(uint8_t* buffer, size_t bytes, uint32_t lineSize, uint32_t* order) {
+    benchBuildChain(buffer, bytes, lineSize, order);
+
+    // One full pass to warm the caches
+    void** p = (void**)buffer;
+    for (size_t i = 0; i < bytes / lineSize; i++) {
+        p = *p;
+    }
+
+    uint64_t loads = 0;
+    uint64_t start = x64TscClockNow(&benchClock);
+    uint64_t elapsed = 0;
+    do {
+        for (uint32_t i = 0; i < BENCH_CHASE_CHUNK; i++) {
+            p = *p;
+        }
+        loads += BENCH_CHASE_CHUNK;
+        elapsed = x64TscClockNow(&benchClock) - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    benchSink += (uintptr_t)p;
+    return (double)elapsed / loads;
+}
+
+// Read bandwidth in GB/s
+static double benchBandwidth(const uint8_t* buffer, size_t bytes) {
+    const uint64_t* words = (const uint64_t*)buffer;
+    const size_t count = bytes / sizeof(uint64_t);
+
+    uint64_t passes = 0;
+    uint64_t sum = 0;
+    uint64_t start = x64TscClockNow(&benchClock);
+    uint64_t elapsed = 0;
+    do {
+        for (size_t i = 0; i < count; i += 4) {
+            sum += words[i] + words[i + 1] + words[i + 2] + words[i + 3];
+        }
+        passes++;
+        elapsed = x64TscClockNow(&benchClock) - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    benchSink += sum;
+    return (double)passes * bytes / elapsed;
+}
+
+static void benchPrintSize(size_t bytes) {
+    if (bytes >= (1u << 20)) {
+        printf("%8.1f MB", bytes / 1048576.0);
+    } else {
+        printf("%8.1f KB", bytes / 1024.0);
+    }
+}
+
+int main() {
+    if (!x64InitCpuidCache()) {
+        printf("This CPU does not support CPUID\n");
+        return 1;
+    }
+    const struct X64Info* cpuid = x64Cpu();
+    x64InitTscClock(&benchClock);
+    const uint32_t lineSize = cpuid->cacheLineSize ? cpuid->cacheLineSize : 64;
+
+    static struct BenchPoint points[2 * X64_MAX_CACHES];
+    uint32_t pointCount = 0;
+    size_t maxBytes = 0;
+    for (uint8_t level = 1; level <= 4; level++) {
+        const struct X64CacheInfo* cache = x64FindDataCache(cpuid, level);
+        if (!cache) {
+            continue;
+        }
+        size_t below = (size_t)cache->sizeBytes * BENCH_BELOW_PERCENT / 100 / lineSize * lineSize;
+        size_t above = (size_t)cache->sizeBytes * BENCH_ABOVE_PERCENT / 100 / lineSize * lineSize;
+        if (above > BENCH_MAX_BUFFER) {
+            printf("L%u is too large to exceed, capping the working set at %llu MB\n",
+                    level, (unsigned long long)(BENCH_MAX_BUFFER >> 20));
+            above = BENCH_MAX_BUFFER;
+        }
+        points[pointCount++] = (struct BenchPoint){ cache, below };
+        points[pointCount++] = (struct BenchPoint){ cache, above };
+        if (above > maxBytes) {
+            maxBytes = above;
+        }
+    }
+    if (pointCount == 0) {
+        printf("CPUID reports no data caches\n");
+        return 1;
+    }
+
+    const size_t hugePage = 2u << 20;
+    const size_t bufferBytes = (maxBytes + hugePage - 1) / hugePage * hugePage;
+    uint8_t* buffer = benchAllocAligned(hugePage, bufferBytes);
+    uint32_t* order = malloc(bufferBytes / lineSize * sizeof(uint32_t));
+    if (!buffer || !order) {
+        printf("Could not allocate %llu MB\n", (unsigned long long)(bufferBytes >> 20));
+        return 1;
+    }
+#ifdef __linux__
+    madvise(buffer, bufferBytes, MADV_HUGEPAGE);
+#endif
+    memset(buffer, 1, bufferBytes);
+
+    printf("Line size: %u bytes, clock: %s\n\n", lineSize, benchClock.enabled ? "TSC" : "OS");
+    printf("%-6s %11s %12s %12s\n", "Cache", "Working set", "Latency", "Bandwidth");
+    for (uint32_t i = 0; i < pointCount; i++) {
+        struct BenchPoint* point = &points[i];
+        point->latencyNs = benchLatency(buffer, point->bytes, lineSize, order);
+        point->gbPerSecond = benchBandwidth(buffer, point->bytes);
+        printf("L%u %-3s ", point->cache->level, i % 2 == 0 ? "<" : ">");
+        benchPrintSize(point->bytes);
+        printf(" %9.2f ns %7.2f GB/s\n", point->latencyNs, point->gbPerSecond);
+    }
+
+    // Points come in (below, above) pairs per level. Exceeding a level must
+    // raise latency, and the next level must not be slower right below its own
+    // size than right above the previous level
+    printf("\n");
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < pointCount; i += 2) {
+        const struct BenchPoint* below = &points[i];
+        const struct BenchPoint* above = &points[i + 1];
+        if (i >= 2 && below->latencyNs > points[i - 1].latencyNs * BENCH_STEP_FACTOR) {
+            printf("L%u: latency already rises below the reported %u KB, the capacity one core "
+                   "can use is smaller (e.g. an L3 split into per CCX or per cluster slices)\n",
+                   below->cache->level, below->cache->sizeBytes / 1024);
+            mismatches++;
+        } else if (above->latencyNs < below->latencyNs * BENCH_STEP_FACTOR) {
+            printf("L%u: no latency step past the reported %u KB, the effective capacity is larger "
+                   "(e.g. an exclusive or victim cache adding the capacity of the level below)\n",
+                   below->cache->level, below->cache->sizeBytes / 1024);
+            mismatches++;
+        }
+    }
+    if (mismatches == 0) {
+        printf("Measured cache boundaries match CPUID\n");
+    }
+
+    free(order);
+    benchFreeAligned(buffer);
+    return 0;
+}
@@ -1 +1,5 @@
 clang -g -masm=intel cli.c -o ./bin/cpuid.exe
+clang -O2 -g -masm=intel bench_dispatch.c -o ./bin/bench_dispatch.exe
+clang -O2 -g -masm=intel bench_cpuid.c -o ./bin/bench_cpuid.exe
+clang -O2 -g -masm=intel bench_memory.c -o ./bin/bench_memory.exe
+clang -g -masm=intel check_writer.c -o ./bin/check_writer.exe
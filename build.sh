@@ -0,0 +1,7 @@
+clang -g -masm=intel -pthread cli.c -o ./bin/cpuid
+clang -O2 -g -masm=intel bench_dispatch.c -o ./bin/bench_dispatch
+clang -O2 -g -masm=intel bench_cpuid.c -o ./bin/bench_cpuid
+clang -O2 -g -masm=intel -pthread aggregate.c -o ./bin/aggregate
+clang -O2 -g -masm=intel bench_memory.c -o ./bin/bench_memory
+clang -g -masm=intel -pthread check_topology.c -o ./bin/check_topology
+clang -g -masm=intel check_writer.c -o ./bin/check_writer
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpuid.c"
+#include "topology.c"
+#include "dump.c"
+#include "consistency.c"
+
+// Replays stand-in /dev/cpu trees through the cpuid device backend, the way
+// `cpuid --cpu-root` does. The CPUs of this host are written out as a tree and
+// must decode to the same topology as the native scan, and synthetic CPUs cover
+// layouts this host does not have. Exits non-zero if any check fails.
+
+static uint32_t checkFailures;
+
+static void checkExpect(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    checkFailures += !ok;
+}
+
+// Removes <root>/<cpu>/cpuid for every CPU of the tree, then the directories
+static void checkRemoveTree(const char* root) {
+    uint32_t cpuIds[X64_MAX_CPUS];
+    uint32_t cpuCount = x64GetTreeCpus(root, cpuIds, X64_MAX_CPUS);
+    char path[256];
+    for (uint32_t i = 0; i < cpuCount; i++) {
+        snprintf(path, sizeof(path), "%s/%u/cpuid", root, cpuIds[i]);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%u", root, cpuIds[i]);
+        rmdir(path);
+    }
+    rmdir(root);
+}
+
+static void checkRecordCpu(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* backend, void* ctx) {
+    struct X64CpuidRecorder* recorders = ctx;
+    struct X64CpuidBackend recordingBackend;
+    x64InitRecorder(&recorders[index], backend, &recordingBackend);
+    x64RecordAllLeaves(&recorders[index]);
+    x64CompactRecorder(&recorders[index]);
+}
+
+// Records every CPU of the current scan root into a tree at root
+static bool checkWriteHostTree(const char* root) {
+    uint32_t cpuIds[X64_MAX_CPUS];
+    uint32_t cpuCount = x64GetScanCpus(cpuIds, X64_MAX_CPUS);
+    struct X64CpuidRecorder* recorders = calloc(cpuCount, sizeof(struct X64CpuidRecorder));
+    bool ok = cpuCount > 0 && recorders && x64QueryEachCpu(cpuIds, cpuCount, checkRecordCpu, recorders);
+    for (uint32_t i = 0; ok && i < cpuCount; i++) {
+        ok = !recorders[i].outOfMemory
+          && x64WriteCpuidTree(recorders[i].entries, recorders[i].entryCount, root, cpuIds[i]);
+    }
+    for (uint32_t i = 0; recorders && i < cpuCount; i++) {
+        x64FreeRecorder(&recorders[i]);
+    }
+    free(recorders);
+    return ok;
+}
+
+static bool checkSameTopology(const struct X64Topology* a, const struct X64Topology* b) {
+    bool same = a->cpuCount == b->cpuCount
+             && a->packageCount == b->packageCount
+             && a->dieCount == b->dieCount
+             && a->coreCount == b->coreCount
+             && a->l3Count == b->l3Count
+             && a->ccxCount == b->ccxCount
+             && a->ccdCount == b->ccdCount
+             && a->nodeCount == b->nodeCount
+             && a->sourceLeaf == b->sourceLeaf
+             && a->smtShift == b->smtShift
+             && a->dieShift == b->dieShift
+             && a->packageShift == b->packageShift;
+    return same && memcmp(a->cpus, b->cpus, a->cpuCount * sizeof(struct X64LogicalCpu)) == 0;
+}
+
+// Writes this host out as a tree and replays it
+static void checkHostTree() {
+    char root[] = "/tmp/check_topologyXXXXXX";
+    if (!mkdtemp(root)) {
+        checkExpect(false, "create a temporary directory");
+        return;
+    }
+
+    struct X64Topology native;
+    x64SetCpuidDeviceRoot(X64_CPUID_DEVICE_ROOT);
+    checkExpect(x64EnumerateTopology(&native), "host: enumerate the native topology");
+    checkExpect(checkWriteHostTree(root), "host: write the CPUs as a stand-in tree");
+
+    struct X64Topology replayed;
+    struct X64ConsistencyReport report;
+    x64SetCpuidDeviceRoot(root);
+    checkExpect(x64EnumerateTopology(&replayed), "host: enumerate the tree");
+    checkExpect(checkSameTopology(&native, &replayed), "host: the tree decodes to the native topology");
+    checkExpect(x64CheckConsistency(&report) && report.cpuCount == native.cpuCount,
+                "host: consistency check over the tree covers every CPU");
+    checkExpect(report.xcr0 == x64Cpu()->xcr0, "host: the tree carries this host's XCR0");
+    x64SetCpuidDeviceRoot(X64_CPUID_DEVICE_ROOT);
+
+    x64FreeTopology(&native);
+    x64FreeTopology(&replayed);
+    checkRemoveTree(root);
+}
+
+// -------------------------------------------------
+//                  Synthetic CPUs
+// -------------------------------------------------
+
+#define CHECK_MAX_LEAVES    64
+
+// Raw leaves of one synthetic CPU. Leaves that are not added read as zero
+struct CheckCpu {
+    struct X64DumpEntry entries[CHECK_MAX_LEAVES];
+    uint32_t            entryCount;
+};
+
+static void checkAddLeaf(struct CheckCpu* cpu, uint32_t leaf, uint32_t subleaf,
+                         uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx) {
+    if (cpu->entryCount < CHECK_MAX_LEAVES) {
+        cpu->entries[cpu->entryCount++] = (struct X64DumpEntry){ leaf, subleaf, { eax, ebx, ecx, edx } };
+    }
+}
+
+// Leaf 0 and 0x80000000 of a GenuineIntel CPU
+static void checkInitIntelCpu(struct CheckCpu* cpu, uint32_t maxLeaf) {
+    *cpu = (struct CheckCpu){};
+    checkAddLeaf(cpu, 0, 0, maxLeaf, 0x756E6547, 0x6C65746E, 0x49656E69);
+    checkAddLeaf(cpu, 0x80000000, 0, 0x80000008, 0, 0, 0);
+}
+
+// Leaf 0, 0x80000000 and 0x80000001 of an AuthenticAMD CPU with TOPOEXT
+static void checkInitAmdCpu(struct CheckCpu* cpu, uint32_t maxLeaf, uint32_t maxExtendedLeaf) {
+    *cpu = (struct CheckCpu){};
+    checkAddLeaf(cpu, 0, 0, maxLeaf, 0x68747541, 0x444D4163, 0x69746E65);
+    checkAddLeaf(cpu, 0x80000000, 0, maxExtendedLeaf, 0, 0, 0);
+    checkAddLeaf(cpu, 0x80000001, 0, 0, 0, X64_EXTENDED_FEATURE_FLAG_ECX_TOPOEXT, 0);
+}
+
+// Backend serving the leaves of a CheckCpu
+static void checkCpuQuery(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
+    const struct CheckCpu* cpu = ctx;
+    *result = (struct X64CpuidResult){};
+    for (uint32_t i = 0; i < cpu->entryCount; i++) {
+        if (cpu->entries[i].leaf == leaf && cpu->entries[i].subleaf == subleaf) {
+            *result = cpu->entries[i].regs;
+        }
+    }
+}
+
+// One level of leaf 0xB/0x1F: shift is the ID width below the next level
+static void checkAddLevel(struct CheckCpu* cpu, uint32_t leaf, uint32_t subleaf,
+                          uint32_t levelType, uint32_t shift, uint32_t x2ApicId) {
+    checkAddLeaf(cpu, leaf, subleaf, shift, 1, levelType << 8 | subleaf, x2ApicId);
+}
+
+// One subleaf of leaf 4/0x8000001D shared by sharing APIC IDs
+static void checkAddCache(struct CheckCpu* cpu, uint32_t leaf, uint32_t subleaf,
+                          uint32_t type, uint32_t level, uint32_t sharing) {
+    checkAddLeaf(cpu, leaf, subleaf, type | level << 5 | (sharing - 1) << 14, 0, 0, 0);
+}
+
+// Writes the CPUs as a tree, enumerates it into topology and removes the tree
+static bool checkEnumerateCpus(const struct CheckCpu* cpus, uint32_t cpuCount, struct X64Topology* topology) {
+    char root[] = "/tmp/check_topologyXXXXXX";
+    if (!mkdtemp(root)) {
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < cpuCount; i++) {
+        ok = x64WriteCpuidTree(cpus[i].entries, cpus[i].entryCount, root, i);
+    }
+    x64SetCpuidDeviceRoot(root);
+    ok = ok && x64EnumerateTopology(topology);
+    x64SetCpuidDeviceRoot(X64_CPUID_DEVICE_ROOT);
+    checkRemoveTree(root);
+    return ok;
+}
+
+// Leaf 0x1F with a die level, x2APIC IDs 0x00 and 0x35. The die ID is taken
+// above the core level's shift, so 0x35 is package 1, die 1, core 2, SMT 1
+static void checkDieLevel() {
+    struct CheckCpu cpus[2];
+    const uint32_t apicIds[2] = { 0x00, 0x35 };
+    for (uint32_t i = 0; i < 2; i++) {
+        checkInitIntelCpu(&cpus[i], 0x1F);
+        checkAddLevel(&cpus[i], 0x1F, 0, X64_TOPOLOGY_LEVEL_SMT, 1, apicIds[i]);
+        checkAddLevel(&cpus[i], 0x1F, 1, X64_TOPOLOGY_LEVEL_CORE, 4, apicIds[i]);
+        checkAddLevel(&cpus[i], 0x1F, 2, X64_TOPOLOGY_LEVEL_DIE, 5, apicIds[i]);
+        checkAddLevel(&cpus[i], 0x1F, 3, X64_TOPOLOGY_LEVEL_INVALID, 0, apicIds[i]);
+    }
+
+    struct X64Topology topology;
+    if (!checkEnumerateCpus(cpus, 2, &topology)) {
+        checkExpect(false, "die level: enumerate the tree");
+        return;
+    }
+    const struct X64LogicalCpu* cpu = &topology.cpus[1];
+    checkExpect(topology.sourceLeaf == 0x1F && topology.smtShift == 1 && topology.dieShift == 4
+                && topology.packageShift == 5, "die level: shifts 1, 4, 5");
+    checkExpect(cpu->packageId == 1 && cpu->dieId == 1 && cpu->coreId == 2 && cpu->smtId == 1,
+                "die level: 0x35 is package 1, die 1, core 2, SMT 1");
+    checkExpect(topology.packageCount == 2 && topology.dieCount == 2 && topology.coreCount == 2,
+                "die level: 2 packages, 2 dies, 2 cores");
+    x64FreeTopology(&topology);
+}
+
+// A hybrid part: one P-core with two threads and a private L2, and a cluster of
+// four E-cores sharing one L2. The L2 IDs must follow each core's own leaf 4
+static void checkHybridL2() {
+    struct CheckCpu cpus[6];
+    const uint32_t apicIds[6] = { 0x00, 0x01, 0x40, 0x42, 0x44, 0x46 };
+    for (uint32_t i = 0; i < 6; i++) {
+        const bool isAtom = apicIds[i] >= 0x40;
+        checkInitIntelCpu(&cpus[i], 0x1A);
+        checkAddLeaf(&cpus[i], 7, 0, 0, 0, 0, X64_STRUCTURED_FEATURE_FLAG_EDX_HYBRID);
+        checkAddLeaf(&cpus[i], 0x1A, 0, (isAtom ? X64_CORE_TYPE_ATOM : X64_CORE_TYPE_CORE) << 24, 0, 0, 0);
+        checkAddLevel(&cpus[i], 0xB, 0, X64_TOPOLOGY_LEVEL_SMT, 1, apicIds[i]);
+        checkAddLevel(&cpus[i], 0xB, 1, X64_TOPOLOGY_LEVEL_CORE, 7, apicIds[i]);
+        checkAddLevel(&cpus[i], 0xB, 2, X64_TOPOLOGY_LEVEL_INVALID, 0, apicIds[i]);
+        checkAddCache(&cpus[i], 4, 0, X64_CACHE_TYPE_DATA, 1, 2);
+        checkAddCache(&cpus[i], 4, 1, X64_CACHE_TYPE_UNIFIED, 2, isAtom ? 8 : 2);
+        checkAddCache(&cpus[i], 4, 2, X64_CACHE_TYPE_UNIFIED, 3, 128);
+    }
+
+    struct X64Topology topology;
+    if (!checkEnumerateCpus(cpus, 6, &topology)) {
+        checkExpect(false, "hybrid: enumerate the tree");
+        return;
+    }
+    struct X64CpuMask mask;
+    checkExpect(topology.isHybrid && x64GetCoreTypeMask(&topology, X64_CORE_TYPE_ATOM, &mask) == 4,
+                "hybrid: 4 E-cores from the tree's leaf 7 and 0x1A");
+    checkExpect(topology.cpus[0].l2Id == 0x00 && topology.cpus[1].l2Id == 0x00,
+                "hybrid: the P-core threads share L2 0x0");
+    bool cluster = true;
+    for (uint32_t i = 2; i < 6; i++) {
+        cluster &= topology.cpus[i].l2Id == 0x40;
+    }
+    checkExpect(cluster, "hybrid: the E-core cluster shares L2 0x40");
+    checkExpect(topology.l3Count == 1 && topology.l3Shift == 7, "hybrid: one L3 across both core types");
+    x64FreeTopology(&topology);
+}
+
+// An EPYC style part with leaf 0x80000026: two CCDs of two CCXs each, one L3
+// per CCX. Each 0x80000026 level's shift yields that level's ID, so CCX IDs
+// step by 8 APIC IDs and CCD IDs by 16
+static void checkAmdComplexes() {
+    struct CheckCpu cpus[4];
+    const uint32_t apicIds[4] = { 0x00, 0x08, 0x10, 0x18 };
+    for (uint32_t i = 0; i < 4; i++) {
+        checkInitAmdCpu(&cpus[i], 0xB, 0x80000026);
+        checkAddLevel(&cpus[i], 0xB, 0, X64_TOPOLOGY_LEVEL_SMT, 1, apicIds[i]);
+        checkAddLevel(&cpus[i], 0xB, 1, X64_TOPOLOGY_LEVEL_CORE, 6, apicIds[i]);
+        checkAddLevel(&cpus[i], 0xB, 2, X64_TOPOLOGY_LEVEL_INVALID, 0, apicIds[i]);
+        checkAddLeaf(&cpus[i], 0x8000001E, 0, apicIds[i], 1 << 8 | apicIds[i] >> 1, 0, 0);
+        checkAddCache(&cpus[i], 0x8000001D, 0, X64_CACHE_TYPE_DATA, 1, 2);
+        checkAddCache(&cpus[i], 0x8000001D, 1, X64_CACHE_TYPE_UNIFIED, 2, 2);
+        checkAddCache(&cpus[i], 0x8000001D, 2, X64_CACHE_TYPE_UNIFIED, 3, 8);
+        const uint32_t levels[4][2] = {
+            { X64_AMD_TOPOLOGY_LEVEL_CORE, 1 },
+            { X64_AMD_TOPOLOGY_LEVEL_COMPLEX, 3 },
+            { X64_AMD_TOPOLOGY_LEVEL_DIE, 4 },
+            { X64_AMD_TOPOLOGY_LEVEL_SOCKET, 6 },
+        };
+        for (uint32_t level = 0; level < 4; level++) {
+            checkAddLeaf(&cpus[i], 0x80000026, level, levels[level][1], 1, levels[level][0] << 8 | level, apicIds[i]);
+        }
+        checkAddLeaf(&cpus[i], 0x80000026, 4, 0, 0, 4, apicIds[i]);
+    }
+
+    struct X64Topology topology;
+    if (!checkEnumerateCpus(cpus, 4, &topology)) {
+        checkExpect(false, "AMD complexes: enumerate the tree");
+        return;
+    }
+    checkExpect(topology.ccxShift == 3 && topology.ccdShift == 4, "AMD complexes: CCX shift 3, CCD shift 4");
+    checkExpect(topology.nodeCount == 1 && topology.ccxCount == 4 && topology.ccdCount == 2 && topology.l3Count == 4,
+                "AMD complexes: 1 node, 2 CCDs, 4 CCXs, 4 L3 domains");
+    checkExpect(topology.cpus[1].ccxId == 0x08 && topology.cpus[1].ccdId == 0x00
+                && topology.cpus[2].ccxId == 0x10 && topology.cpus[2].ccdId == 0x10,
+                "AMD complexes: 0x08 is CCX 0x08 of CCD 0x0, 0x10 is CCX 0x10 of CCD 0x10");
+    x64FreeTopology(&topology);
+
+    // A capture must keep every 0x80000026 level, not just subleaf 0
+    struct X64CpuidBackend source = { checkCpuQuery, &cpus[0] };
+    struct X64CpuidBackend backend;
+    struct X64CpuidRecorder recorder;
+    x64InitRecorder(&recorder, &source, &backend);
+    x64RecordAllLeaves(&recorder);
+    x64CompactRecorder(&recorder);
+    uint32_t levelCount = 0;
+    for (uint32_t i = 0; i < recorder.entryCount; i++) {
+        levelCount += recorder.entries[i].leaf == 0x80000026;
+    }
+    checkExpect(!recorder.outOfMemory && levelCount == 5, "AMD complexes: a capture records all 5 subleaves of 0x80000026");
+    x64FreeRecorder(&recorder);
+}
+
+// Decodes CPU 0 of a tree holding cpu. XCR0 must come from the tree, never from
+// the host running the check
+static uint64_t checkTreeXcr0(const struct CheckCpu* cpu) {
+    char root[] = "/tmp/check_topologyXXXXXX";
+    struct X64CpuidDevice device;
+    struct X64CpuidBackend backend;
+    struct X64Info info = {};
+    if (mkdtemp(root) && x64WriteCpuidTree(cpu->entries, cpu->entryCount, root, 0)
+        && x64OpenCpuidDevice(root, 0, &device, &backend)) {
+        getCpuidInfoFromBackend(&backend, &info);
+        x64CloseCpuidDevice(&device);
+    }
+    checkRemoveTree(root);
+    return info.xcr0;
+}
+
+static void checkStandInXcr0() {
+    struct CheckCpu cpu;
+    checkInitIntelCpu(&cpu, 1);
+    checkAddLeaf(&cpu, 1, 0, 0, 0, X64_FEATURE_FLAG_ECX_XSAVE | X64_FEATURE_FLAG_ECX_OSXSAVE, 0);
+    checkExpect(checkTreeXcr0(&cpu) == 0, "XCR0: a tree without XCR0 reports none enabled");
+    checkAddLeaf(&cpu, X64_PSEUDO_LEAF_XCR0, 0, 0x3, 0, 0, 0);
+    checkExpect(checkTreeXcr0(&cpu) == 0x3, "XCR0: a tree's own XCR0 is used");
+}
+
+int main() {
+    if (!x64InitCpuidCache()) {
+        printf("This CPU does not support CPUID\n");
+        return 1;
+    }
+
+    checkHostTree();
+    checkDieLevel();
+    checkHybridL2();
+    checkAmdComplexes();
+    checkStandInXcr0();
+
+    printf("\n%u checks failed\n", checkFailures);
+    return checkFailures != 0;
+}
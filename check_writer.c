@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpuid.c"
+#include "writer.c"
+
+// Round trips X64Info through the --binary format. A struct with every member
+// set to a non-zero value must read back byte for byte apart from its padding,
+// so a member added to X64Info without a record fails here instead of silently
+// missing from the inventory output. Exits non-zero if any check fails.
+
+// Layout of X64Info when the writer last covered every member. A new member
+// changes the size, give it a record in writer.c and x64ReadInfoBinary, then
+// update both numbers from the check output
+#define CHECK_INFO_SIZE         1136
+#define CHECK_INFO_PADDING      107
+
+_Static_assert(sizeof(struct X64Info) == CHECK_INFO_SIZE,
+               "X64Info changed: serialize the new members in writer.c and update CHECK_INFO_SIZE");
+
+static uint32_t checkFailures;
+
+static void checkExpect(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    checkFailures += !ok;
+}
+
+static char checkBuffer[64 * 1024];
+static char checkSecondBuffer[64 * 1024];
+
+// Writes cpuid as binary into buffer and reads it back into readBack
+static bool checkWriteAndRead(const struct X64Info* cpuid, char* buffer, size_t* length, struct X64Info* readBack) {
+    struct X64Writer writer;
+    x64WriterInit(&writer, buffer, sizeof(checkBuffer));
+    x64WriteInfoBinary(&writer, cpuid);
+    *length = writer.length;
+    return !writer.overflow && x64ReadInfoBinary(buffer, writer.length, readBack);
+}
+
+// The host decodes to whatever this CPU has, so compare the encodings: writing
+// the read back struct must reproduce the first output exactly
+static void checkHost() {
+    struct X64Info cpuid;
+    if (!getCpuidInfo(&cpuid)) {
+        checkExpect(false, "host: decode CPUID");
+        return;
+    }
+    struct X64Info readBack;
+    struct X64Info readBackAgain;
+    size_t length;
+    size_t secondLength;
+    bool ok = checkWriteAndRead(&cpuid, checkBuffer, &length, &readBack)
+           && checkWriteAndRead(&readBack, checkSecondBuffer, &secondLength, &readBackAgain);
+    checkExpect(ok && length == secondLength && memcmp(checkBuffer, checkSecondBuffer, length) == 0,
+                "host: binary round trip");
+
+    struct X64Writer writer;
+    x64WriterInit(&writer, checkBuffer, sizeof(checkBuffer));
+    x64WriteInfoJson(&writer, &cpuid);
+    checkExpect(!writer.overflow && writer.length > 2 && writer.buffer[0] == '{'
+                && memcmp(&writer.buffer[writer.length - 2], "}\n", 2) == 0,
+                "host: JSON output is one object");
+}
+
+// Every member non-zero: bytes are 0x01 so bools stay valid, the counts are at
+// their maximum so every array entry is written. The string terminators are
+// not part of the format. Bytes that read back as 0 were not carried, which
+// must be exactly the padding
+static void checkEveryMember() {
+    struct X64Info cpuid;
+    memset(&cpuid, 0x01, sizeof(cpuid));
+    cpuid.vendorString[CPUID_VENDOR_STRING_SIZE] = 0;
+    cpuid.hypervisorVendor[CPUID_VENDOR_STRING_SIZE] = 0;
+    cpuid.leaf2DescriptorCount = X64_MAX_LEAF2_DESCRIPTORS;
+    cpuid.cacheCount = X64_MAX_CACHES;
+    cpuid.tlbCount = X64_MAX_TLBS;
+
+    struct X64Info readBack;
+    size_t length;
+    if (!checkWriteAndRead(&cpuid, checkBuffer, &length, &readBack)) {
+        checkExpect(false, "every X64Info member survives a binary round trip");
+        return;
+    }
+    const uint8_t* expected = (const uint8_t*)&cpuid;
+    const uint8_t* actual = (const uint8_t*)&readBack;
+    uint32_t lost = 0;
+    for (size_t i = 0; i < sizeof(struct X64Info); i++) {
+        lost += expected[i] != actual[i];
+    }
+    if (lost != CHECK_INFO_PADDING) {
+        printf("     %u bytes did not survive, expected %u bytes of padding at offsets:\n    ", lost, CHECK_INFO_PADDING);
+        for (size_t i = 0; i < sizeof(struct X64Info); i++) {
+            if (expected[i] != actual[i]) {
+                printf(" %zu", i);
+            }
+        }
+        printf("\n");
+    }
+    checkExpect(lost == CHECK_INFO_PADDING, "every X64Info member survives a binary round trip");
+
+    struct X64Writer writer;
+    x64WriterInit(&writer, checkBuffer, sizeof(checkBuffer));
+    x64WriteInfoJson(&writer, &cpuid);
+    checkExpect(!writer.overflow, "JSON of a fully populated X64Info fits the CLI buffer");
+}
+
+static void checkMalformed() {
+    struct X64Info cpuid = {};
+    struct X64Writer writer;
+    x64WriterInit(&writer, checkBuffer, sizeof(checkBuffer));
+    x64WriteInfoBinary(&writer, &cpuid);
+
+    struct X64Info readBack;
+    checkExpect(!x64ReadInfoBinary(writer.buffer, writer.length - 1, &readBack), "truncated record is rejected");
+    checkBuffer[0] = 'Y';
+    checkExpect(!x64ReadInfoBinary(writer.buffer, writer.length, &readBack), "wrong magic is rejected");
+    checkBuffer[0] = 'X';
+
+    // A record with a tag from a newer writer is skipped
+    const uint16_t header[2] = { 0xFFFF, 4 };
+    x64WriterPutBytes(&writer, header, sizeof(header));
+    x64WriterPutBytes(&writer, "abcd", 4);
+    checkExpect(x64ReadInfoBinary(writer.buffer, writer.length, &readBack), "unknown tag is skipped");
+}
+
+int main() {
+    checkHost();
+    checkEveryMember();
+    checkMalformed();
+
+    printf("\n%u checks failed\n", checkFailures);
+    return checkFailures != 0;
+}
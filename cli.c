@@ -1,18 +1,363 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <signal.h>
 #include "cpuid.c"
+#include "topology.c"
+#include "dump.c"
+#include "writer.c"
+#include "affinity.c"
+#include "consistency.c"
+#include "shm.c"
+#include "pmu.c"
 
-int main() {
-    printf("==============================================\n"
-           "               CPUID Information\n"
-           "==============================================\n");
+// Seconds between republishing, so CPUs brought online later show up
+#define CLI_DAEMON_INTERVAL     60
+
+// Records every raw leaf of this CPU into a capture file
+static int cliDump(const char* path) {
+    if (!x64SupportsCpuid()) {
+        printf("This CPU does not support CPUID\n");
+        return 1;
+    }
+
+    struct X64CpuidRecorder recorder;
+    struct X64CpuidBackend recordingBackend;
+    x64InitRecorder(&recorder, &x64NativeBackend, &recordingBackend);
+    bool ok = x64RecordAllLeaves(&recorder) && x64WriteCpuidDump(&recorder, path);
+    if (ok) {
+        printf("Wrote %u leaves to %s\n", recorder.entryCount, path);
+    } else {
+        printf("Could not write %s\n", path);
+    }
+    x64FreeRecorder(&recorder);
+    return ok ? 0 : 1;
+}
+
+static void cliRecordCpu(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* backend, void* ctx) {
+    struct X64CpuidRecorder* recorders = ctx;
+    struct X64CpuidBackend recordingBackend;
+    x64InitRecorder(&recorders[index], backend, &recordingBackend);
+    x64RecordAllLeaves(&recorders[index]);
+    x64CompactRecorder(&recorders[index]);
+}
+
+// Writes a stand-in /dev/cpu tree for --cpu-root: the replayed capture as
+// CPU 0, or else every CPU of this host
+static int cliDumpTree(const char* root, const char* replayPath) {
+    if (replayPath) {
+        struct X64CpuidDump dump;
+        if (!x64OpenCpuidDump(replayPath, &dump)) {
+            printf("%s is not a valid CPUID capture\n", replayPath);
+            return 1;
+        }
+        bool ok = x64WriteCpuidTree(dump.entries, dump.entryCount, root, 0);
+        x64CloseCpuidDump(&dump);
+        printf(ok ? "Wrote %s as CPU 0 of %s\n" : "Could not write %s to %s\n", replayPath, root);
+        return ok ? 0 : 1;
+    }
+
+    uint32_t cpuIds[X64_MAX_CPUS];
+    uint32_t cpuCount = x64GetScanCpus(cpuIds, X64_MAX_CPUS);
+    struct X64CpuidRecorder* recorders = calloc(cpuCount, sizeof(struct X64CpuidRecorder));
+    bool ok = cpuCount > 0 && recorders && x64QueryEachCpu(cpuIds, cpuCount, cliRecordCpu, recorders);
+    for (uint32_t i = 0; ok && i < cpuCount; i++) {
+        ok = !recorders[i].outOfMemory
+          && x64WriteCpuidTree(recorders[i].entries, recorders[i].entryCount, root, cpuIds[i]);
+    }
+    for (uint32_t i = 0; recorders && i < cpuCount; i++) {
+        x64FreeRecorder(&recorders[i]);
+    }
+    free(recorders);
+    printf(ok ? "Wrote %u CPUs to %s\n" : "Could not record %u CPUs to %s\n", cpuCount, root);
+    return ok ? 0 : 1;
+}
+
+// Prints a thread placement plan for this host as CPU lists for deployment configs
+static int cliAffinity(const char* policyName, const char* threads) {
+    enum X64PlacementPolicy policy = X64_PLACEMENT_PHYSICAL_CORES;
+    if (strcmp(policyName, "compact") == 0) {
+        policy = X64_PLACEMENT_COMPACT;
+    } else if (strcmp(policyName, "spread") == 0) {
+        policy = X64_PLACEMENT_SPREAD;
+    } else if (strcmp(policyName, "physical") != 0) {
+        printf("Unknown placement policy %s, expected physical, compact or spread\n", policyName);
+        return 1;
+    }
+
+    struct X64Topology topology = {};
+    struct X64PlacementPlan plan;
+    if (!x64EnumerateTopology(&topology)) {
+        printf("Topology unavailable\n");
+        return 1;
+    }
+    bool ok = x64PlanPlacement(&topology, policy, (uint32_t)strtoul(threads, 0, 10), &plan);
+    x64FreeTopology(&topology);
+    if (!ok) {
+        printf("No CPUs available for placement\n");
+        return 1;
+    }
+
+    printf("Threads:");
+    for (uint32_t i = 0; i < plan.threadCount; i++) {
+        printf("%s%u", i == 0 ? " " : ",", plan.cpus[i]);
+    }
+    printf("\nIdle siblings:");
+    bool first = true;
+    for (uint32_t cpu = 0; cpu < X64_MAX_CPUS; cpu++) {
+        if (x64CpuMaskHas(&plan.idleSiblings, cpu)) {
+            printf("%s%u", first ? " " : ",", cpu);
+            first = false;
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+// Compares CPUID across all online CPUs, exits with 1 if they disagree
+static int cliCheckConsistency() {
+    static struct X64ConsistencyReport report;
+    if (!x64CheckConsistency(&report)) {
+        printf("Could not read CPUID on every CPU\n");
+        return 2;
+    }
+
+    printf("Checked %u CPUs against CPU %u\n", report.cpuCount, report.referenceCpu);
+    static const char* const regNames[4] = { "EAX", "EBX", "ECX", "EDX" };
+    for (uint32_t i = 0; i < report.diffCount && i < X64_MAX_CPUID_DIFFS; i++) {
+        const struct X64CpuidDiff* diff = &report.diffs[i];
+        printf("\tCPU %u: leaf 0x%x.%u %s is 0x%08x, expected 0x%08x (differing bits 0x%08x)\n",
+                diff->osCpuId, diff->leaf, diff->subleaf, regNames[diff->reg],
+                diff->actual, diff->expected, diff->mask);
+    }
+    if (report.diffCount > X64_MAX_CPUID_DIFFS) {
+        printf("\t... %u more\n", report.diffCount - X64_MAX_CPUID_DIFFS);
+    }
+
+    for (uint32_t feature = 0; feature < X64_FEATURE_BITS; feature++) {
+        if (x64FeatureSetHas(&report.differingFeatures, feature) && x64FeatureNames[feature]) {
+            printf("\tNot on every CPU: %s\n", x64FeatureNames[feature]);
+        }
+    }
+
+    if (report.diffCount == 0) {
+        printf("All CPUs report identical CPUID values\n");
+        return 0;
+    }
+    printf("CPUs disagree in %u registers, common usable features 0x%x\n", report.diffCount, report.usableFeatures);
+    return 1;
+}
+
+#define CLI_PROFILE_ITERATIONS  1000000
+
+// A loop of known length: a multiply-add chain the compiler cannot fold or
+// vectorize, one iteration per loop trip
+static __attribute__((noinline)) uint64_t cliProfileLoop(uint64_t iterations) {
+    uint64_t value = 1;
+    for (uint64_t i = 0; i < iterations; i++) {
+        value = value * 3 + i;
+        __asm__ volatile("" : "+r"(value));
+    }
+    return value;
+}
+
+// Deltas of the open counters across cliProfileLoop(iterations)
+static void cliProfileDeltas(const struct X64Profiler* profiler, uint64_t iterations, struct X64PmuSample* delta) {
+    struct X64PmuSample before;
+    x64ProfilerRead(profiler, &before);
+    cliProfileLoop(iterations);
+    x64ProfilerRead(profiler, delta);
+    for (uint32_t i = 0; i < X64_PMU_COUNTER_COUNT; i++) {
+        delta->values[i] -= before.values[i];
+    }
+    delta->rdpmcCounters &= before.rdpmcCounters;
+}
+
+// Counts what decoding CPUID costs on this host, after checking that the
+// instruction and cycle counters count at all and scale with a loop four times
+// as long. Returns 1 if they do not
+static int cliProfile() {
+    struct X64Profiler profiler;
+    if (!x64OpenProfiler(&profiler)) {
+        printf("No performance counters available (no PMU, or perf_event_paranoid too strict)\n");
+        return 1;
+    }
+
+    static const char* const counterNames[X64_PMU_COUNTER_COUNT] = { "Instructions", "Cycles", "LLC misses" };
+    struct X64Info cpuid;
+    struct X64PmuSample before;
+    struct X64PmuSample after;
+    x64ProfilerRead(&profiler, &before);
+    getCpuidInfo(&cpuid);
+    x64ProfilerRead(&profiler, &after);
+
+    printf("getCpuidInfo() in user mode:\n");
+    for (uint32_t i = 0; i < X64_PMU_COUNTER_COUNT; i++) {
+        if (profiler.counters & (1 << i)) {
+            const bool rdpmc = (before.rdpmcCounters & after.rdpmcCounters) & (1 << i);
+            printf("\t%s: %llu (%s)\n", counterNames[i], (unsigned long long)(after.values[i] - before.values[i]),
+                   rdpmc ? "RDPMC" : "read()");
+        } else {
+            printf("\t%s: unavailable\n", counterNames[i]);
+        }
+    }
+
+    // Instructions must scale almost exactly with the trip count, cycles only
+    // roughly since frequency and interrupts vary
+    struct X64PmuSample shortRun;
+    struct X64PmuSample longRun;
+    cliProfileDeltas(&profiler, CLI_PROFILE_ITERATIONS, &shortRun);
+    cliProfileDeltas(&profiler, 4 * CLI_PROFILE_ITERATIONS, &longRun);
+    static const double minRatio[2] = { 3.5, 2.0 };
+    static const double maxRatio[2] = { 4.5, 8.0 };
+    uint32_t failures = 0;
+    printf("\nLoop of %u and %u iterations:\n", CLI_PROFILE_ITERATIONS, 4 * CLI_PROFILE_ITERATIONS);
+    for (uint32_t i = X64_PMU_INSTRUCTIONS; i <= X64_PMU_CYCLES; i++) {
+        if (!(profiler.counters & (1 << i))) {
+            continue;
+        }
+        const double ratio = shortRun.values[i] ? (double)longRun.values[i] / shortRun.values[i] : 0;
+        const bool ok = shortRun.values[i] != 0 && ratio >= minRatio[i] && ratio <= maxRatio[i];
+        printf("\t%s: %llu, %llu, ratio %.2f (%s)%s\n", counterNames[i],
+               (unsigned long long)shortRun.values[i], (unsigned long long)longRun.values[i], ratio,
+               (shortRun.rdpmcCounters & longRun.rdpmcCounters) & (1 << i) ? "RDPMC" : "read()",
+               ok ? "" : ", expected non-zero and about 4");
+        failures += !ok;
+    }
+    x64CloseProfiler(&profiler);
+    return failures != 0;
+}
 
+static volatile sig_atomic_t cliStop;
+
+static void cliOnSignal(int signal) {
+    cliStop = 1;
+}
+
+// Publishes X64Info and the topology to shared memory until SIGINT or SIGTERM
+static int cliDaemon(const char* name) {
+#if defined(__unix__)
     struct X64Info cpuid = {};
-    bool hasCpuid = getCpuidInfo(&cpuid);
-    if (!hasCpuid) {
+    if (!getCpuidInfo(&cpuid)) {
         printf("This CPU does not support CPUID\n");
         return 1;
     }
+    struct X64SharedSegment segment;
+    if (!x64CreateShared(name, &segment)) {
+        printf("Could not create shared memory segment %s\n", name);
+        return 1;
+    }
+    signal(SIGINT, cliOnSignal);
+    signal(SIGTERM, cliOnSignal);
+
+    for (uint32_t elapsed = 0; !cliStop; elapsed++) {
+        if (elapsed % CLI_DAEMON_INTERVAL == 0) {
+            struct X64Topology topology = {};
+            bool hasTopology = x64EnumerateTopology(&topology);
+            x64PublishShared(&segment, &cpuid, hasTopology ? &topology : 0);
+            x64FreeTopology(&topology);
+            if (elapsed == 0) {
+                printf("Published to %s (%zu bytes)\n", name, sizeof(struct X64SharedInfo));
+                fflush(stdout);
+            }
+        }
+        sleep(1);
+    }
+
+    x64CloseShared(&segment);
+    x64UnlinkShared(name);
+    return 0;
+#else
+    printf("Shared memory publishing is not supported on this platform\n");
+    return 1;
+#endif
+}
+
+enum CliFormat {
+    CLI_FORMAT_TEXT,
+    CLI_FORMAT_JSON,
+    CLI_FORMAT_BINARY,
+};
+
+// Serializes cpuid to stdout with a single write
+static int cliWriteInfo(const struct X64Info* cpuid, enum CliFormat format) {
+    static char buffer[64 * 1024];
+    struct X64Writer writer;
+    x64WriterInit(&writer, buffer, sizeof(buffer));
+    if (format == CLI_FORMAT_JSON) {
+        x64WriteInfoJson(&writer, cpuid);
+    } else {
+        x64WriteInfoBinary(&writer, cpuid);
+    }
+    return x64WriterFlush(&writer, 1) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    const char* replayPath = 0;
+    const char* treePath = 0;
+    enum CliFormat format = CLI_FORMAT_TEXT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            return cliDump(argv[i + 1]);
+        } else if (strcmp(argv[i], "--check") == 0) {
+            return cliCheckConsistency();
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            return cliProfile();
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            return cliDaemon(i + 1 < argc ? argv[i + 1] : X64_SHARED_NAME);
+        } else if (strcmp(argv[i], "--affinity") == 0 && i + 2 < argc) {
+            return cliAffinity(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--cpu-root") == 0 && i + 1 < argc) {
+            x64SetCpuidDeviceRoot(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-tree") == 0 && i + 1 < argc) {
+            treePath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            format = CLI_FORMAT_JSON;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            format = CLI_FORMAT_BINARY;
+        } else {
+            printf("Usage: %s [--cpu-root <dir>] [--dump <file> | --replay <file>] [--json | --binary]\n"
+                   "       %s [--cpu-root <dir> | --replay <file>] --dump-tree <dir>\n"
+                   "       %s [--cpu-root <dir>] --affinity <physical|compact|spread> <threads>\n"
+                   "       %s [--cpu-root <dir>] --check\n"
+                   "       %s --daemon [/shm-name]\n"
+                   "       %s --profile\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    if (treePath) {
+        return cliDumpTree(treePath, replayPath);
+    }
+
+    struct X64Info cpuid = {};
+    struct X64CpuidDump dump = {};
+    if (replayPath) {
+        struct X64CpuidBackend backend;
+        if (!x64OpenCpuidDump(replayPath, &dump)) {
+            printf("%s is not a valid CPUID capture\n", replayPath);
+            return 1;
+        }
+        x64DumpBackend(&dump, &backend);
+        getCpuidInfoFromBackend(&backend, &cpuid);
+    } else {
+        bool hasCpuid = getCpuidInfo(&cpuid);
+        if (!hasCpuid) {
+            printf("This CPU does not support CPUID\n");
+            return 1;
+        }
+    }
+
+    if (format != CLI_FORMAT_TEXT) {
+        int status = cliWriteInfo(&cpuid, format);
+        x64CloseCpuidDump(&dump);
+        return status;
+    }
 
+    printf("==============================================\n"
+           "               CPUID Information\n"
+           "==============================================\n");
     printf("%s\n\n", cpuid.brandString);
 
     printf("Leaf 0H:\n");
@@ -36,17 +381,8 @@ int main() {
     }
 
     printf("\tStepping ID: %u\n", cpuid.steppingId);
-    uint32_t displayModel = cpuid.modelId;
-    if (cpuid.familyId == 0xF || cpuid.familyId == 0x6) {
-        displayModel = (cpuid.extendedModelId << 4) + cpuid.modelId;
-    }
-    printf("\tModel: %x\n", displayModel);
-
-    uint32_t displayFamily = cpuid.familyId;
-    if (cpuid.familyId == 0xF) {
-        displayFamily = cpuid.extendedFamilyId + cpuid.familyId;
-    }
-    printf("\tFamily: %x\n", displayFamily);
+    printf("\tModel: %x\n", x64GetDisplayModel(&cpuid));
+    printf("\tFamily: %x\n", x64GetDisplayFamily(&cpuid));
     printf("\tProcessor Type: %s\n", processorTypeStr);
 
     char* brandString = 0;
@@ -60,10 +396,216 @@ int main() {
     printf("\tMaximum number of addressable IDs for logical processors in this physical package: %u\n", 
             cpuid.maxNumberLogicalProcessorIds);
     printf("\tInitial APIC ID: %u\n", cpuid.initialApicId);
+    if (cpuid.packageThreads) {
+        printf("\tLogical processors per package (Leaf 0x80000008): %u, APIC ID core bits: %u\n",
+                cpuid.packageThreads, cpuid.apicIdCoreIdSize);
+    }
+    if (cpuid.threadsPerComputeUnit) {
+        printf("\tExtended APIC ID (Leaf 0x8000001E): 0x%x, Compute unit %u (%u threads), Node %u of %u per package\n",
+                cpuid.extendedApicId, cpuid.computeUnitId, cpuid.threadsPerComputeUnit,
+                cpuid.nodeId, cpuid.nodesPerPackage);
+    }
 
     printf("\nFeature Set:\n");
     x64PrintFeatureSet(&cpuid);
 
+    printf("\nUsable Vector Extensions (XCR0 0x%llx):\n", (unsigned long long)cpuid.xcr0);
+    x64PrintUsableFeatures(&cpuid);
+
 
     printf("Leaf 2H:\n");
+    for (uint32_t i = 0; i < cpuid.leaf2DescriptorCount; i++) {
+        char* descString = 0;
+        bool validDesc = x64TranslateLeaf2Descriptor(cpuid.leaf2Descriptors[i], &descString);
+        if (validDesc) {
+            printf("\t%s\n", descString);
+        }
+    }
+
+    printf("\nCache Hierarchy (Leaf 0x%x):\n", cpuid.cacheLeaf);
+    for (uint32_t i = 0; i < cpuid.cacheCount; i++) {
+        struct X64CacheInfo* cache = &cpuid.caches[i];
+        char* typeStr = "Unified";
+        switch (cache->type) {
+        case X64_CACHE_TYPE_DATA:           typeStr = "Data"; break;
+        case X64_CACHE_TYPE_INSTRUCTION:    typeStr = "Instruction"; break;
+        }
+
+        printf("\tL%u %s: %u KB, %u-way, %u byte line size, %u sets, shared by up to %u threads%s\n",
+                cache->level, typeStr, cache->sizeBytes / 1024, cache->ways, cache->lineSize,
+                cache->sets, cache->maxThreadsSharing, cache->inclusive ? ", inclusive" : "");
+    }
+
+    printf("\nTLBs (Leaf 0x%x):\n", cpuid.tlbLeaf);
+    if (cpuid.tlbCount == 0) {
+        printf("\tNot reported\n");
+    }
+    uint8_t maxTlbLevel = 0;
+    for (uint32_t i = 0; i < cpuid.tlbCount; i++) {
+        struct X64TlbInfo* tlb = &cpuid.tlbs[i];
+        char* typeStr = "Unified";
+        switch (tlb->type) {
+        case X64_TLB_TYPE_DATA:         typeStr = "Data"; break;
+        case X64_TLB_TYPE_INSTRUCTION:  typeStr = "Instruction"; break;
+        case X64_TLB_TYPE_LOAD_ONLY:    typeStr = "Load"; break;
+        case X64_TLB_TYPE_STORE_ONLY:   typeStr = "Store"; break;
+        }
+        printf("\tL%u %s:%s%s%s%s pages, %u entries, ", tlb->level, typeStr,
+                (tlb->pageSizes & X64_TLB_PAGE_4K) ? " 4K" : "", (tlb->pageSizes & X64_TLB_PAGE_2M) ? " 2M" : "",
+                (tlb->pageSizes & X64_TLB_PAGE_4M) ? " 4M" : "", (tlb->pageSizes & X64_TLB_PAGE_1G) ? " 1G" : "",
+                tlb->entries);
+        if (tlb->fullyAssociative) {
+            printf("fully associative\n");
+        } else {
+            printf("%u-way\n", tlb->ways);
+        }
+        if (tlb->level > maxTlbLevel) {
+            maxTlbLevel = tlb->level;
+        }
+    }
+    for (uint8_t level = 1; level <= maxTlbLevel; level++) {
+        printf("\tL%u data reach: 4K pages %llu KB, 2M pages %llu MB, 1G pages %llu GB\n", level,
+                (unsigned long long)(x64GetTlbReach(&cpuid, level, X64_TLB_PAGE_4K) >> 10),
+                (unsigned long long)(x64GetTlbReach(&cpuid, level, X64_TLB_PAGE_2M) >> 20),
+                (unsigned long long)(x64GetTlbReach(&cpuid, level, X64_TLB_PAGE_1G) >> 30));
+    }
+
+    printf("\nXSAVE (Leaf 0xD):\n");
+    bool compacted = false;
+    uint32_t areaSize = x64GetXsaveAreaSize(&cpuid, &compacted);
+    if (areaSize == 0) {
+        printf("\tNot enabled\n");
+    } else {
+        const uint64_t enabled = cpuid.xcr0 & cpuid.xsaveSupportedComponents;
+        printf("\tStandard size: %u bytes enabled, %u bytes all supported\n", cpuid.xsaveEnabledSize, cpuid.xsaveMaxSize);
+        printf("\tCompacted size: %u bytes enabled\n", x64GetXsaveSize(&cpuid, enabled, true));
+        printf("\tXSAVEOPT: %s, XSAVEC: %s, XSAVES: %s\n",
+                (cpuid.xsaveFeatures & X64_XSAVE_FEATURE_FLAG_EAX_XSAVEOPT) ? "yes" : "no",
+                (cpuid.xsaveFeatures & X64_XSAVE_FEATURE_FLAG_EAX_XSAVEC) ? "yes" : "no",
+                (cpuid.xsaveFeatures & X64_XSAVE_FEATURE_FLAG_EAX_XSAVES) ? "yes" : "no");
+        printf("\tPer context area: %u bytes (%s)\n", areaSize, compacted ? "XSAVEC" : "XSAVE");
+        for (uint32_t i = 0; i < X64_MAX_XSAVE_COMPONENTS; i++) {
+            const struct X64XsaveComponent* component = &cpuid.xsaveComponents[i];
+            if (component->size == 0) {
+                continue;
+            }
+            printf("\tComponent %2u: %5u bytes, offset %5u, compacted offset %5u%s%s%s\n", i, component->size,
+                    component->offset, x64GetXsaveOffset(&cpuid, enabled, i, true),
+                    (enabled & (1ull << i)) ? ", enabled" : "",
+                    component->supervisor ? ", supervisor" : "", component->aligned ? ", 64 byte aligned" : "");
+        }
+    }
+
+    printf("\nHypervisor:\n");
+    if (cpuid.hypervisor == X64_HYPERVISOR_NONE) {
+        printf("\tNone\n");
+    } else {
+        printf("\t%s (\"%s\"), Max leaf: 0x%x\n", x64HypervisorName(cpuid.hypervisor),
+                cpuid.hypervisorVendor, cpuid.hypervisorMaxLeaf);
+        printf("\tFeatures: 0x%x, Hints: 0x%x\n", cpuid.hypervisorFeatures, cpuid.hypervisorHints);
+        if (cpuid.hypervisor == X64_HYPERVISOR_KVM) {
+            const struct { uint32_t flag; const char* name; } kvmFeatures[] = {
+                { X64_KVM_FEATURE_CLOCKSOURCE2,         "kvmclock" },
+                { X64_KVM_FEATURE_CLOCKSOURCE_STABLE,   "stable clock" },
+                { X64_KVM_FEATURE_STEAL_TIME,           "steal time" },
+                { X64_KVM_FEATURE_PV_EOI,               "PV EOI" },
+                { X64_KVM_FEATURE_PV_UNHALT,            "PV unhalt" },
+                { X64_KVM_FEATURE_PV_TLB_FLUSH,         "PV TLB flush" },
+                { X64_KVM_FEATURE_PV_SEND_IPI,          "PV send IPI" },
+                { X64_KVM_FEATURE_POLL_CONTROL,         "poll control" },
+                { X64_KVM_FEATURE_PV_SCHED_YIELD,       "PV sched yield" },
+            };
+            for (uint32_t i = 0; i < sizeof(kvmFeatures) / sizeof(kvmFeatures[0]); i++) {
+                if (cpuid.hypervisorFeatures & kvmFeatures[i].flag) {
+                    printf("\t\t%s\n", kvmFeatures[i].name);
+                }
+            }
+            if (cpuid.hypervisorHints & X64_KVM_HINT_REALTIME) {
+                printf("\t\tdedicated vCPUs\n");
+            }
+        }
+        if (cpuid.hypervisorTscKhz) {
+            printf("\tTSC frequency: %u kHz\n", cpuid.hypervisorTscKhz);
+        }
+    }
+    struct X64SpinStrategy spin;
+    x64GetSpinStrategy(&cpuid, &spin);
+    if (spin.spinIterations == UINT32_MAX) {
+        printf("\tSpin strategy: busy spin\n");
+    } else {
+        printf("\tSpin strategy: spin %u iterations, then %s\n", spin.spinIterations,
+                spin.paravirtYield ? "directed yield" : "yield");
+    }
+
+    printf("\nPerformance Monitoring (Leaf 0xA):\n");
+    if (cpuid.pmuVersion == 0) {
+        printf("\tNot reported\n");
+    } else {
+        printf("\tVersion %u, %u general purpose counters of %u bits, %u fixed counters of %u bits (mask 0x%x)\n",
+                cpuid.pmuVersion, cpuid.pmuCounters, cpuid.pmuCounterWidth,
+                cpuid.pmuFixedCounters, cpuid.pmuFixedCounterWidth, cpuid.pmuFixedCounterMask);
+        static const char* const eventNames[] = {
+            "core cycles", "instructions", "reference cycles", "LLC references",
+            "LLC misses", "branches", "branch misses", "top-down slots",
+        };
+        printf("\tArchitectural events:");
+        for (uint32_t i = 0; i < sizeof(eventNames) / sizeof(eventNames[0]); i++) {
+            if (cpuid.pmuEvents & (1u << i)) {
+                printf(" %s%s", eventNames[i], cpuid.pmuEvents >> (i + 1) ? "," : "");
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\nTime Stamp Counter:\n");
+    printf("\tInvariant: %s\n", (cpuid.powerFeatures & X64_POWER_FLAG_EDX_INVARIANT_TSC) ? "yes" : "no");
+    printf("\tTSC/crystal ratio: %u/%u, Crystal: %u Hz\n",
+            cpuid.tscNumerator, cpuid.tscDenominator, cpuid.crystalHz);
+    printf("\tBase: %u MHz, Max: %u MHz, Bus: %u MHz\n", cpuid.baseMhz, cpuid.maxMhz, cpuid.busMhz);
+    uint64_t tscHz = x64GetTscFrequency(&cpuid);
+    if (tscHz) {
+        printf("\tTSC frequency: %llu Hz\n", (unsigned long long)tscHz);
+    } else {
+        printf("\tTSC frequency: not enumerated\n");
+    }
+
+    // The topology is read live from every CPU and is not part of a capture
+    if (replayPath) {
+        x64CloseCpuidDump(&dump);
+        return 0;
+    }
+
+    printf("\nTopology:\n");
+    struct X64Topology topology = {};
+    if (!x64EnumerateTopology(&topology)) {
+        printf("\tUnavailable\n");
+        return 0;
+    }
+    printf("\tSource leaf: 0x%x\n", topology.sourceLeaf);
+    printf("\tPackages: %u, Dies: %u, L3 domains: %u, Cores: %u, Logical processors: %u\n",
+            topology.packageCount, topology.dieCount, topology.l3Count, topology.coreCount, topology.cpuCount);
+    if (topology.nodeCount) {
+        printf("\tNodes: %u, CCDs: %u, CCXs: %u\n", topology.nodeCount, topology.ccdCount, topology.ccxCount);
+    }
+    if (topology.isHybrid) {
+        struct X64CpuMask mask;
+        printf("\tHybrid: %u performance, %u efficiency logical processors\n",
+                x64GetCoreTypeMask(&topology, X64_CORE_TYPE_CORE, &mask),
+                x64GetCoreTypeMask(&topology, X64_CORE_TYPE_ATOM, &mask));
+    }
+    for (uint32_t i = 0; i < topology.cpuCount; i++) {
+        struct X64LogicalCpu* cpu = &topology.cpus[i];
+        char* coreTypeStr = "";
+        switch (cpu->coreType) {
+        case X64_CORE_TYPE_CORE:    coreTypeStr = ", P-core"; break;
+        case X64_CORE_TYPE_ATOM:    coreTypeStr = ", E-core"; break;
+        }
+        printf("\tCPU %3u: x2APIC ID 0x%x, Package %u, Die %u, Core %u, SMT %u, L2 0x%x, L3 0x%x",
+                cpu->osCpuId, cpu->x2ApicId, cpu->packageId, cpu->dieId, cpu->coreId, cpu->smtId, cpu->l2Id, cpu->l3Id);
+        if (topology.nodeCount) {
+            printf(", Node %u, CCD 0x%x, CCX 0x%x", cpu->nodeId, cpu->ccdId, cpu->ccxId);
+        }
+        printf("%s\n", coreTypeStr);
+    }
+    x64FreeTopology(&topology);
 }
@@ -0,0 +1,175 @@
+// Cross-CPU CPUID consistency check.
+//
+// Every online CPU decodes its own X64Info through a recording backend, read
+// from its cpuid device or by a thread pinned to it. The recorded leaves are
+// then compared against the first CPU register by register. Fields that
+// identify the executing CPU (APIC IDs, core and node IDs) are masked out
+// before comparing, so whatever still differs is a real disagreement: hybrid
+// core types, mismatched microcode, or vCPUs a hypervisor presents differently.
+//
+// The report also carries the features every CPU has in common, which is what
+// code may safely dispatch on when threads can migrate.
+//
+// Requires cpuid.c, topology.c and dump.c to be included first.
+
+#define X64_MAX_CPUID_DIFFS     256
+
+struct X64CpuidDiff {
+    uint32_t    osCpuId;
+    uint32_t    leaf;
+    uint32_t    subleaf;
+    // 0 to 3 for EAX, EBX, ECX, EDX
+    uint8_t     reg;
+    // Register value on the reference CPU and on osCpuId. A leaf that only one
+    // of them reports has a mask of all ones
+    uint32_t    expected;
+    uint32_t    actual;
+    uint32_t    mask;
+};
+
+struct X64ConsistencyReport {
+    uint32_t            cpuCount;
+    uint32_t            referenceCpu;
+    // Total number of differing registers, only the first X64_MAX_CPUID_DIFFS are kept
+    uint32_t            diffCount;
+    struct X64CpuidDiff diffs[X64_MAX_CPUID_DIFFS];
+    // Intersection over all CPUs
+    struct X64FeatureSet features;
+    // Features some but not all CPUs report
+    struct X64FeatureSet differingFeatures;
+    uint32_t            usableFeatures;
+    uint64_t            xcr0;
+};
+
+// Clears the register bits that legitimately differ between CPUs
+static void x64MaskPerCpuFields(uint32_t leaf, uint32_t* regs) {
+    switch (leaf) {
+    case 1:
+        // Initial APIC ID
+        regs[1] &= 0x00FFFFFF;
+        break;
+    case 0xB:
+    case 0x1F:
+    case 0x80000026:
+        // x2APIC ID
+        regs[3] = 0;
+        break;
+    case 0x8000001E:
+        // Extended APIC ID, core ID and node ID
+        regs[0] = 0;
+        regs[1] &= ~0xFFu;
+        regs[2] &= ~0xFFu;
+        break;
+    }
+}
+
+static void x64AddCpuidDiff(struct X64ConsistencyReport* report, uint32_t osCpuId, uint32_t leaf, uint32_t subleaf,
+                            uint8_t reg, uint32_t expected, uint32_t actual, uint32_t mask) {
+    if (report->diffCount < X64_MAX_CPUID_DIFFS) {
+        report->diffs[report->diffCount] = (struct X64CpuidDiff){ osCpuId, leaf, subleaf, reg, expected, actual, mask };
+    }
+    report->diffCount++;
+}
+
+static void x64CompareEntries(struct X64ConsistencyReport* report, uint32_t osCpuId,
+                              const struct X64DumpEntry* expected, const struct X64DumpEntry* actual) {
+    uint32_t a[4] = { expected->regs.eax, expected->regs.ebx, expected->regs.ecx, expected->regs.edx };
+    uint32_t b[4] = { actual->regs.eax, actual->regs.ebx, actual->regs.ecx, actual->regs.edx };
+    x64MaskPerCpuFields(expected->leaf, a);
+    x64MaskPerCpuFields(expected->leaf, b);
+    for (uint8_t reg = 0; reg < 4; reg++) {
+        if (a[reg] != b[reg]) {
+            x64AddCpuidDiff(report, osCpuId, expected->leaf, expected->subleaf, reg, a[reg], b[reg], a[reg] ^ b[reg]);
+        }
+    }
+}
+
+// Merges two sorted recordings and reports every register that differs
+static void x64DiffRecorders(struct X64ConsistencyReport* report, uint32_t osCpuId,
+                             const struct X64CpuidRecorder* expected, const struct X64CpuidRecorder* actual) {
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < expected->entryCount || j < actual->entryCount) {
+        int order = i == expected->entryCount ? 1
+                  : j == actual->entryCount ? -1
+                  : x64CompareDumpEntries(&expected->entries[i], &actual->entries[j]);
+        if (order == 0) {
+            x64CompareEntries(report, osCpuId, &expected->entries[i++], &actual->entries[j++]);
+        } else if (order < 0) {
+            x64AddCpuidDiff(report, osCpuId, expected->entries[i].leaf, expected->entries[i].subleaf,
+                            0, expected->entries[i].regs.eax, 0, 0xFFFFFFFF);
+            i++;
+        } else {
+            x64AddCpuidDiff(report, osCpuId, actual->entries[j].leaf, actual->entries[j].subleaf,
+                            0, 0, actual->entries[j].regs.eax, 0xFFFFFFFF);
+            j++;
+        }
+    }
+}
+
+struct X64ConsistencyScan {
+    struct X64CpuidRecorder*    recorders;
+    struct X64Info*             infos;
+};
+
+static void x64ConsistencyScanCpu(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* source, void* ctx) {
+    struct X64ConsistencyScan* scan = ctx;
+    struct X64CpuidBackend backend;
+    x64InitRecorder(&scan->recorders[index], source, &backend);
+    getCpuidInfoFromBackend(&backend, &scan->infos[index]);
+    x64CompactRecorder(&scan->recorders[index]);
+}
+
+// Decodes CPUID on every online CPU and diffs the results against the first
+// one. Returns false if the CPUs could not be scanned; the CPUs agree when
+// report->diffCount is 0
+bool x64CheckConsistency(struct X64ConsistencyReport* report) {
+    *report = (struct X64ConsistencyReport){};
+    if (!x64SupportsCpuid()) {
+        return false;
+    }
+
+    uint32_t cpuIds[X64_MAX_CPUS];
+    uint32_t cpuCount = x64GetScanCpus(cpuIds, X64_MAX_CPUS);
+    if (cpuCount == 0) {
+        return false;
+    }
+
+    struct X64ConsistencyScan scan = {};
+    scan.recorders = calloc(cpuCount, sizeof(struct X64CpuidRecorder));
+    scan.infos = calloc(cpuCount, sizeof(struct X64Info));
+    // malloc alignment on x64 covers the 16 bytes X64FeatureSet asks for
+    struct X64FeatureSet* features = calloc(cpuCount, sizeof(struct X64FeatureSet));
+    bool ok = scan.recorders && scan.infos && features
+           && x64QueryEachCpu(cpuIds, cpuCount, x64ConsistencyScanCpu, &scan);
+    for (uint32_t i = 0; ok && i < cpuCount; i++) {
+        ok = !scan.recorders[i].outOfMemory;
+    }
+
+    if (ok) {
+        report->cpuCount = cpuCount;
+        report->referenceCpu = cpuIds[0];
+        report->usableFeatures = scan.infos[0].usableFeatures;
+        report->xcr0 = scan.infos[0].xcr0;
+        for (uint32_t i = 0; i < cpuCount; i++) {
+            features[i] = scan.infos[i].features;
+            report->usableFeatures &= scan.infos[i].usableFeatures;
+            report->xcr0 &= scan.infos[i].xcr0;
+            if (i > 0) {
+                x64DiffRecorders(report, cpuIds[i], &scan.recorders[0], &scan.recorders[i]);
+            }
+        }
+        struct X64FeatureSet all;
+        x64FeatureSetIntersectMany(features, cpuCount, &report->features);
+        x64FeatureSetUnionMany(features, cpuCount, &all);
+        x64FeatureSetDiff(&all, &report->features, &report->differingFeatures);
+    }
+
+    for (uint32_t i = 0; scan.recorders && i < cpuCount; i++) {
+        x64FreeRecorder(&scan.recorders[i]);
+    }
+    free(scan.recorders);
+    free(scan.infos);
+    free(features);
+    return ok;
+}
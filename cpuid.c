@@ -1,5 +1,8 @@
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
 
 #define CPUID_VENDOR_STRING_SIZE    12
 #define CPUID_BRAND_STRING_SIZE     48
@@ -18,29 +21,30 @@
 #define X64_FEATURE_FLAG_ECX_DS_CPL         (1 << 4)
 #define X64_FEATURE_FLAG_ECX_VMX            (1 << 5)
 #define X64_FEATURE_FLAG_ECX_SMX            (1 << 6)
-#define X64_FEATURE_FLAG_ECX_EIST           (1 << 8)
-#define X64_FEATURE_FLAG_ECX_TM2            (1 << 9)
-#define X64_FEATURE_FLAG_ECX_SSSE2          (1 << 10)
-#define X64_FEATURE_FLAG_ECX_CNXT_ID        (1 << 11)
-#define X64_FEATURE_FLAG_ECX_SDBG           (1 << 12)
-#define X64_FEATURE_FLAG_ECX_FMA            (1 << 13)
-#define X64_FEATURE_FLAG_ECX_CMPXCHG16B     (1 << 14)
-#define X64_FEATURE_FLAG_ECX_XTPR           (1 << 15)
-#define X64_FEATURE_FLAG_ECX_PDCM           (1 << 16)
-#define X64_FEATURE_FLAG_ECX_PCID           (1 << 18)
-#define X64_FEATURE_FLAG_ECX_DCA            (1 << 19)
-#define X64_FEATURE_FLAG_ECX_SSE4_1         (1 << 20)
-#define X64_FEATURE_FLAG_ECX_SSE4_2         (1 << 21)
-#define X64_FEATURE_FLAG_ECX_X2APIC         (1 << 22)
-#define X64_FEATURE_FLAG_ECX_MOVBE          (1 << 23)
-#define X64_FEATURE_FLAG_ECX_POPCNT         (1 << 24)
-#define X64_FEATURE_FLAG_ECX_TSC_DEADLINE   (1 << 25)
-#define X64_FEATURE_FLAG_ECX_AES            (1 << 26)
-#define X64_FEATURE_FLAG_ECX_XSAVE          (1 << 27)
-#define X64_FEATURE_FLAG_ECX_OSXSAVE        (1 << 28)
-#define X64_FEATURE_FLAG_ECX_AVX            (1 << 29)
-#define X64_FEATURE_FLAG_ECX_F16C           (1 << 30)
-#define X64_FEATURE_FLAG_ECX_RDRAND         (1 << 31)
+#define X64_FEATURE_FLAG_ECX_EIST           (1 << 7)
+#define X64_FEATURE_FLAG_ECX_TM2            (1 << 8)
+#define X64_FEATURE_FLAG_ECX_SSSE3          (1 << 9)
+#define X64_FEATURE_FLAG_ECX_CNXT_ID        (1 << 10)
+#define X64_FEATURE_FLAG_ECX_SDBG           (1 << 11)
+#define X64_FEATURE_FLAG_ECX_FMA            (1 << 12)
+#define X64_FEATURE_FLAG_ECX_CMPXCHG16B     (1 << 13)
+#define X64_FEATURE_FLAG_ECX_XTPR           (1 << 14)
+#define X64_FEATURE_FLAG_ECX_PDCM           (1 << 15)
+#define X64_FEATURE_FLAG_ECX_PCID           (1 << 17)
+#define X64_FEATURE_FLAG_ECX_DCA            (1 << 18)
+#define X64_FEATURE_FLAG_ECX_SSE4_1         (1 << 19)
+#define X64_FEATURE_FLAG_ECX_SSE4_2         (1 << 20)
+#define X64_FEATURE_FLAG_ECX_X2APIC         (1 << 21)
+#define X64_FEATURE_FLAG_ECX_MOVBE          (1 << 22)
+#define X64_FEATURE_FLAG_ECX_POPCNT         (1 << 23)
+#define X64_FEATURE_FLAG_ECX_TSC_DEADLINE   (1 << 24)
+#define X64_FEATURE_FLAG_ECX_AES            (1 << 25)
+#define X64_FEATURE_FLAG_ECX_XSAVE          (1 << 26)
+#define X64_FEATURE_FLAG_ECX_OSXSAVE        (1 << 27)
+#define X64_FEATURE_FLAG_ECX_AVX            (1 << 28)
+#define X64_FEATURE_FLAG_ECX_F16C           (1 << 29)
+#define X64_FEATURE_FLAG_ECX_RDRAND         (1 << 30)
+#define X64_FEATURE_FLAG_ECX_HYPERVISOR     (1u << 31)
 
 #define X64_FEATURE_FLAG_ECX_PBE            (1 << 31)
 #define X64_FEATURE_FLAG_ECX_TM             (1 << 29)
@@ -72,6 +76,369 @@
 #define X64_FEATURE_FLAG_ECX_VME            (1 << 1)
 #define X64_FEATURE_FLAG_ECX_FPU            1
 
+// Leaf 7 subleaf 0
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_FSGSBASE        1
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_BMI1            (1 << 3)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_HLE             (1 << 4)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX2            (1 << 5)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_SMEP            (1 << 7)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_BMI2            (1 << 8)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_ERMS            (1 << 9)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_INVPCID         (1 << 10)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_RTM             (1 << 11)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512F         (1 << 16)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512DQ        (1 << 17)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_RDSEED          (1 << 18)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_ADX             (1 << 19)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_SMAP            (1 << 20)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512_IFMA     (1 << 21)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_CLFLUSHOPT      (1 << 23)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_CLWB            (1 << 24)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512PF        (1 << 26)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512ER        (1 << 27)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512CD        (1 << 28)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_SHA             (1 << 29)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512BW        (1 << 30)
+#define X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512VL        (1u << 31)
+
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VBMI     (1 << 1)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_UMIP            (1 << 2)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_PKU             (1 << 3)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_OSPKE           (1 << 4)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_WAITPKG         (1 << 5)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VBMI2    (1 << 6)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_GFNI            (1 << 8)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_VAES            (1 << 9)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_VPCLMULQDQ      (1 << 10)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VNNI     (1 << 11)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_BITALG   (1 << 12)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VPOPCNTDQ (1 << 14)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_RDPID           (1 << 22)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_CLDEMOTE        (1 << 25)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_MOVDIRI         (1 << 27)
+#define X64_STRUCTURED_FEATURE_FLAG_ECX_MOVDIR64B       (1 << 28)
+
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_FSRM            (1 << 4)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_AVX512_VP2INTERSECT (1 << 8)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_SERIALIZE       (1 << 14)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_HYBRID          (1 << 15)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_TSXLDTRK        (1 << 16)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_BF16        (1 << 22)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_AVX512_FP16     (1 << 23)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_TILE        (1 << 24)
+#define X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_INT8        (1 << 25)
+
+#define X64_EXTENDED_FEATURE_FLAG_ECX_TOPOEXT     (1 << 22)
+
+// Leaf 0x80000007 EDX
+#define X64_POWER_FLAG_EDX_INVARIANT_TSC          (1 << 8)
+
+// -------------------------------------------------
+//                  Performance monitoring
+// -------------------------------------------------
+
+// Architectural events of leaf 0xA. EBX sets the bit of an event that is
+// NOT available, pmuEvents stores them inverted
+#define X64_PMU_EVENT_CORE_CYCLES               1
+#define X64_PMU_EVENT_INSTRUCTIONS              (1 << 1)
+#define X64_PMU_EVENT_REFERENCE_CYCLES          (1 << 2)
+#define X64_PMU_EVENT_LLC_REFERENCES            (1 << 3)
+#define X64_PMU_EVENT_LLC_MISSES                (1 << 4)
+#define X64_PMU_EVENT_BRANCHES                  (1 << 5)
+#define X64_PMU_EVENT_BRANCH_MISSES             (1 << 6)
+#define X64_PMU_EVENT_TOPDOWN_SLOTS             (1 << 7)
+
+// -------------------------------------------------
+//                  Hypervisor
+// -------------------------------------------------
+
+// Vendor signature in leaf 0x40000000 EBX/ECX/EDX
+enum X64Hypervisor {
+    X64_HYPERVISOR_NONE         = 0,
+    X64_HYPERVISOR_UNKNOWN      = 1,
+    X64_HYPERVISOR_KVM          = 2,
+    X64_HYPERVISOR_HYPERV       = 3,
+    X64_HYPERVISOR_VMWARE       = 4,
+    X64_HYPERVISOR_XEN          = 5,
+    X64_HYPERVISOR_TCG          = 6,
+    X64_HYPERVISOR_VIRTUALBOX   = 7,
+    X64_HYPERVISOR_ACRN         = 8,
+    X64_HYPERVISOR_BHYVE        = 9,
+};
+
+// KVM, leaf 0x40000001 EAX
+#define X64_KVM_FEATURE_CLOCKSOURCE             1
+#define X64_KVM_FEATURE_NOP_IO_DELAY            (1 << 1)
+#define X64_KVM_FEATURE_CLOCKSOURCE2            (1 << 3)
+#define X64_KVM_FEATURE_ASYNC_PF                (1 << 4)
+#define X64_KVM_FEATURE_STEAL_TIME              (1 << 5)
+#define X64_KVM_FEATURE_PV_EOI                  (1 << 6)
+#define X64_KVM_FEATURE_PV_UNHALT               (1 << 7)
+#define X64_KVM_FEATURE_PV_TLB_FLUSH            (1 << 9)
+#define X64_KVM_FEATURE_ASYNC_PF_VMEXIT         (1 << 10)
+#define X64_KVM_FEATURE_PV_SEND_IPI             (1 << 11)
+#define X64_KVM_FEATURE_POLL_CONTROL            (1 << 12)
+#define X64_KVM_FEATURE_PV_SCHED_YIELD          (1 << 13)
+#define X64_KVM_FEATURE_ASYNC_PF_INT            (1 << 14)
+#define X64_KVM_FEATURE_MSI_EXT_DEST_ID         (1 << 15)
+#define X64_KVM_FEATURE_CLOCKSOURCE_STABLE      (1 << 24)
+// KVM, leaf 0x40000001 EDX
+// vCPUs are pinned to dedicated physical CPUs and never preempted
+#define X64_KVM_HINT_REALTIME                   1
+
+// Hyper-V, leaf 0x40000003 EAX partition privileges
+#define X64_HYPERV_FEATURE_VP_RUNTIME           1
+#define X64_HYPERV_FEATURE_TIME_REF_COUNT       (1 << 1)
+#define X64_HYPERV_FEATURE_SYNIC                (1 << 2)
+#define X64_HYPERV_FEATURE_SYNTIMER             (1 << 3)
+#define X64_HYPERV_FEATURE_APIC_ACCESS          (1 << 4)
+#define X64_HYPERV_FEATURE_HYPERCALL            (1 << 5)
+#define X64_HYPERV_FEATURE_REFERENCE_TSC        (1 << 9)
+#define X64_HYPERV_FEATURE_FREQUENCY_MSRS       (1 << 11)
+// Hyper-V, leaf 0x40000004 EAX recommendations
+#define X64_HYPERV_HINT_REMOTE_TLB_FLUSH        (1 << 2)
+#define X64_HYPERV_HINT_APIC_ACCESS_MSRS        (1 << 3)
+#define X64_HYPERV_HINT_RELAXED_TIMING          (1 << 5)
+#define X64_HYPERV_HINT_CLUSTER_IPI             (1 << 10)
+#define X64_HYPERV_HINT_EX_PROCESSOR_MASKS      (1 << 11)
+// Hyper-V spin retry count meaning spinlocks should never notify the hypervisor
+#define X64_HYPERV_SPIN_NEVER_NOTIFY            0xFFFFFFFF
+
+// XCR0 state components enabled by the OS
+#define X64_XCR0_X87            1
+#define X64_XCR0_SSE            (1 << 1)
+#define X64_XCR0_AVX            (1 << 2)
+#define X64_XCR0_OPMASK         (1 << 5)
+#define X64_XCR0_ZMM_HI256      (1 << 6)
+#define X64_XCR0_HI16_ZMM       (1 << 7)
+#define X64_XCR0_PKRU           (1 << 9)
+#define X64_XCR0_XTILECFG       (1 << 17)
+#define X64_XCR0_XTILEDATA      (1 << 18)
+
+// Leaf 0xD subleaf 1 EAX
+#define X64_XSAVE_FEATURE_FLAG_EAX_XSAVEOPT     1
+#define X64_XSAVE_FEATURE_FLAG_EAX_XSAVEC       (1 << 1)
+#define X64_XSAVE_FEATURE_FLAG_EAX_XGETBV_ECX1  (1 << 2)
+#define X64_XSAVE_FEATURE_FLAG_EAX_XSAVES       (1 << 3)
+#define X64_XSAVE_FEATURE_FLAG_EAX_XFD          (1 << 4)
+
+// State components 0 and 1 live in the 512 byte legacy FXSAVE region, which
+// is followed by the 64 byte XSAVE header. Extended components start after it
+#define X64_XSAVE_LEGACY_SIZE       512
+#define X64_XSAVE_HEADER_SIZE       64
+#define X64_XSAVE_EXTENDED_OFFSET   (X64_XSAVE_LEGACY_SIZE + X64_XSAVE_HEADER_SIZE)
+#define X64_MAX_XSAVE_COMPONENTS    32
+
+// Vector extensions that are both reported by CPUID and have their register
+// state enabled by the OS in XCR0. SIMD code must gate on these, not on the raw
+// CPUID bits
+#define X64_USABLE_SSE              1
+#define X64_USABLE_SSE2             (1 << 1)
+#define X64_USABLE_SSE3             (1 << 2)
+#define X64_USABLE_SSSE3            (1 << 3)
+#define X64_USABLE_SSE4_1           (1 << 4)
+#define X64_USABLE_SSE4_2           (1 << 5)
+#define X64_USABLE_AVX              (1 << 6)
+#define X64_USABLE_F16C             (1 << 7)
+#define X64_USABLE_FMA              (1 << 8)
+#define X64_USABLE_AVX2             (1 << 9)
+#define X64_USABLE_AVX512F          (1 << 10)
+#define X64_USABLE_AVX512CD         (1 << 11)
+#define X64_USABLE_AVX512BW         (1 << 12)
+#define X64_USABLE_AVX512DQ         (1 << 13)
+#define X64_USABLE_AVX512VL         (1 << 14)
+#define X64_USABLE_AVX512_IFMA      (1 << 15)
+#define X64_USABLE_AVX512_VBMI      (1 << 16)
+#define X64_USABLE_AVX512_VBMI2     (1 << 17)
+#define X64_USABLE_AVX512_VNNI      (1 << 18)
+#define X64_USABLE_AVX512_BITALG    (1 << 19)
+#define X64_USABLE_AVX512_VPOPCNTDQ (1 << 20)
+#define X64_USABLE_AVX512_FP16      (1 << 21)
+#define X64_USABLE_VAES             (1 << 22)
+#define X64_USABLE_VPCLMULQDQ       (1 << 23)
+#define X64_USABLE_GFNI             (1 << 24)
+// On Linux a process must additionally request the tile data state with
+// x64RequestAmxPermission() before executing AMX instructions
+#define X64_USABLE_AMX_TILE         (1 << 25)
+#define X64_USABLE_AMX_INT8         (1 << 26)
+#define X64_USABLE_AMX_BF16         (1 << 27)
+
+// -------------------------------------------------
+//                  Feature bitset
+// -------------------------------------------------
+
+// Every feature register gets a fixed 32 bit slot, so the bit index of a
+// feature is slot * 32 + its CPUID bit and never changes between releases.
+// New registers are only ever appended as new slots
+enum X64FeatureSlot {
+    X64_FEATURE_SLOT_LEAF1_ECX          = 0,
+    X64_FEATURE_SLOT_LEAF1_EDX          = 1,
+    X64_FEATURE_SLOT_LEAF7_EBX          = 2,
+    X64_FEATURE_SLOT_LEAF7_ECX          = 3,
+    X64_FEATURE_SLOT_LEAF7_EDX          = 4,
+    X64_FEATURE_SLOT_LEAF7_1_EAX        = 5,
+    X64_FEATURE_SLOT_LEAFD_1_EAX        = 6,
+    X64_FEATURE_SLOT_EXTENDED_ECX       = 7,
+    X64_FEATURE_SLOT_EXTENDED_EDX       = 8,
+    X64_FEATURE_SLOT_POWER_EDX          = 9,
+    X64_FEATURE_SLOT_COUNT              = 16,
+};
+
+#define X64_FEATURE_BITS    (X64_FEATURE_SLOT_COUNT * 32)
+#define X64_FEATURE_WORDS   (X64_FEATURE_BITS / 64)
+
+// X(name, slot, bit, display name)
+#define X64_FEATURE_LIST(X) \
+    X(SSE3,             LEAF1_ECX,      0,  "SSE3") \
+    X(PCLMULQDQ,        LEAF1_ECX,      1,  "PCLMULQDQ") \
+    X(DTES64,           LEAF1_ECX,      2,  "DTES64") \
+    X(MONITOR,          LEAF1_ECX,      3,  "MONITOR") \
+    X(DS_CPL,           LEAF1_ECX,      4,  "DS-CPL") \
+    X(VMX,              LEAF1_ECX,      5,  "VMX") \
+    X(SMX,              LEAF1_ECX,      6,  "SMX") \
+    X(EIST,             LEAF1_ECX,      7,  "EIST") \
+    X(TM2,              LEAF1_ECX,      8,  "TM2") \
+    X(SSSE3,            LEAF1_ECX,      9,  "SSSE3") \
+    X(CNXT_ID,          LEAF1_ECX,      10, "CNXT-ID") \
+    X(SDBG,             LEAF1_ECX,      11, "SDBG") \
+    X(FMA,              LEAF1_ECX,      12, "FMA") \
+    X(CMPXCHG16B,       LEAF1_ECX,      13, "CMPXCHG16B") \
+    X(XTPR,             LEAF1_ECX,      14, "xTPR") \
+    X(PDCM,             LEAF1_ECX,      15, "PDCM") \
+    X(PCID,             LEAF1_ECX,      17, "PCID") \
+    X(DCA,              LEAF1_ECX,      18, "DCA") \
+    X(SSE4_1,           LEAF1_ECX,      19, "SSE4.1") \
+    X(SSE4_2,           LEAF1_ECX,      20, "SSE4.2") \
+    X(X2APIC,           LEAF1_ECX,      21, "x2APIC") \
+    X(MOVBE,            LEAF1_ECX,      22, "MOVBE") \
+    X(POPCNT,           LEAF1_ECX,      23, "POPCNT") \
+    X(TSC_DEADLINE,     LEAF1_ECX,      24, "TSC-Deadline") \
+    X(AES,              LEAF1_ECX,      25, "AES") \
+    X(XSAVE,            LEAF1_ECX,      26, "XSAVE") \
+    X(OSXSAVE,          LEAF1_ECX,      27, "OSXSAVE") \
+    X(AVX,              LEAF1_ECX,      28, "AVX") \
+    X(F16C,             LEAF1_ECX,      29, "F16C") \
+    X(RDRAND,           LEAF1_ECX,      30, "RDRAND") \
+    X(HYPERVISOR,       LEAF1_ECX,      31, "HYPERVISOR") \
+    X(FPU,              LEAF1_EDX,      0,  "FPU") \
+    X(VME,              LEAF1_EDX,      1,  "VME") \
+    X(DE,               LEAF1_EDX,      2,  "DE") \
+    X(PSE,              LEAF1_EDX,      3,  "PSE") \
+    X(TSC,              LEAF1_EDX,      4,  "TSC") \
+    X(MSR,              LEAF1_EDX,      5,  "MSR") \
+    X(PAE,              LEAF1_EDX,      6,  "PAE") \
+    X(MCE,              LEAF1_EDX,      7,  "MCE") \
+    X(CX8,              LEAF1_EDX,      8,  "CX8") \
+    X(APIC,             LEAF1_EDX,      9,  "APIC") \
+    X(SEP,              LEAF1_EDX,      11, "SEP") \
+    X(MTRR,             LEAF1_EDX,      12, "MTRR") \
+    X(PGE,              LEAF1_EDX,      13, "PGE") \
+    X(MCA,              LEAF1_EDX,      14, "MCA") \
+    X(CMOV,             LEAF1_EDX,      15, "CMOV") \
+    X(PAT,              LEAF1_EDX,      16, "PAT") \
+    X(PSE_36,           LEAF1_EDX,      17, "PSE-36") \
+    X(PSN,              LEAF1_EDX,      18, "PSN") \
+    X(CLFSH,            LEAF1_EDX,      19, "CLFSH") \
+    X(DS,               LEAF1_EDX,      21, "DS") \
+    X(ACPI,             LEAF1_EDX,      22, "ACPI") \
+    X(MMX,              LEAF1_EDX,      23, "MMX") \
+    X(FXSR,             LEAF1_EDX,      24, "FXSR") \
+    X(SSE,              LEAF1_EDX,      25, "SSE") \
+    X(SSE2,             LEAF1_EDX,      26, "SSE2") \
+    X(SS,               LEAF1_EDX,      27, "SS") \
+    X(HTT,              LEAF1_EDX,      28, "HTT") \
+    X(TM,               LEAF1_EDX,      29, "TM") \
+    X(PBE,              LEAF1_EDX,      31, "PBE") \
+    X(FSGSBASE,         LEAF7_EBX,      0,  "FSGSBASE") \
+    X(BMI1,             LEAF7_EBX,      3,  "BMI1") \
+    X(HLE,              LEAF7_EBX,      4,  "HLE") \
+    X(AVX2,             LEAF7_EBX,      5,  "AVX2") \
+    X(SMEP,             LEAF7_EBX,      7,  "SMEP") \
+    X(BMI2,             LEAF7_EBX,      8,  "BMI2") \
+    X(ERMS,             LEAF7_EBX,      9,  "ERMS") \
+    X(INVPCID,          LEAF7_EBX,      10, "INVPCID") \
+    X(RTM,              LEAF7_EBX,      11, "RTM") \
+    X(AVX512F,          LEAF7_EBX,      16, "AVX512F") \
+    X(AVX512DQ,         LEAF7_EBX,      17, "AVX512DQ") \
+    X(RDSEED,           LEAF7_EBX,      18, "RDSEED") \
+    X(ADX,              LEAF7_EBX,      19, "ADX") \
+    X(SMAP,             LEAF7_EBX,      20, "SMAP") \
+    X(AVX512_IFMA,      LEAF7_EBX,      21, "AVX512_IFMA") \
+    X(CLFLUSHOPT,       LEAF7_EBX,      23, "CLFLUSHOPT") \
+    X(CLWB,             LEAF7_EBX,      24, "CLWB") \
+    X(AVX512PF,         LEAF7_EBX,      26, "AVX512PF") \
+    X(AVX512ER,         LEAF7_EBX,      27, "AVX512ER") \
+    X(AVX512CD,         LEAF7_EBX,      28, "AVX512CD") \
+    X(SHA,              LEAF7_EBX,      29, "SHA") \
+    X(AVX512BW,         LEAF7_EBX,      30, "AVX512BW") \
+    X(AVX512VL,         LEAF7_EBX,      31, "AVX512VL") \
+    X(AVX512_VBMI,      LEAF7_ECX,      1,  "AVX512_VBMI") \
+    X(UMIP,             LEAF7_ECX,      2,  "UMIP") \
+    X(PKU,              LEAF7_ECX,      3,  "PKU") \
+    X(OSPKE,            LEAF7_ECX,      4,  "OSPKE") \
+    X(WAITPKG,          LEAF7_ECX,      5,  "WAITPKG") \
+    X(AVX512_VBMI2,     LEAF7_ECX,      6,  "AVX512_VBMI2") \
+    X(GFNI,             LEAF7_ECX,      8,  "GFNI") \
+    X(VAES,             LEAF7_ECX,      9,  "VAES") \
+    X(VPCLMULQDQ,       LEAF7_ECX,      10, "VPCLMULQDQ") \
+    X(AVX512_VNNI,      LEAF7_ECX,      11, "AVX512_VNNI") \
+    X(AVX512_BITALG,    LEAF7_ECX,      12, "AVX512_BITALG") \
+    X(AVX512_VPOPCNTDQ, LEAF7_ECX,      14, "AVX512_VPOPCNTDQ") \
+    X(RDPID,            LEAF7_ECX,      22, "RDPID") \
+    X(CLDEMOTE,         LEAF7_ECX,      25, "CLDEMOTE") \
+    X(MOVDIRI,          LEAF7_ECX,      27, "MOVDIRI") \
+    X(MOVDIR64B,        LEAF7_ECX,      28, "MOVDIR64B") \
+    X(FSRM,             LEAF7_EDX,      4,  "FSRM") \
+    X(AVX512_VP2INTERSECT, LEAF7_EDX,   8,  "AVX512_VP2INTERSECT") \
+    X(SERIALIZE,        LEAF7_EDX,      14, "SERIALIZE") \
+    X(HYBRID,           LEAF7_EDX,      15, "HYBRID") \
+    X(TSXLDTRK,         LEAF7_EDX,      16, "TSXLDTRK") \
+    X(AMX_BF16,         LEAF7_EDX,      22, "AMX-BF16") \
+    X(AVX512_FP16,      LEAF7_EDX,      23, "AVX512_FP16") \
+    X(AMX_TILE,         LEAF7_EDX,      24, "AMX-TILE") \
+    X(AMX_INT8,         LEAF7_EDX,      25, "AMX-INT8") \
+    X(AVX_VNNI,         LEAF7_1_EAX,    4,  "AVX-VNNI") \
+    X(AVX512_BF16,      LEAF7_1_EAX,    5,  "AVX512_BF16") \
+    X(AVX_IFMA,         LEAF7_1_EAX,    23, "AVX-IFMA") \
+    X(XSAVEOPT,         LEAFD_1_EAX,    0,  "XSAVEOPT") \
+    X(XSAVEC,           LEAFD_1_EAX,    1,  "XSAVEC") \
+    X(XGETBV_ECX1,      LEAFD_1_EAX,    2,  "XGETBV-ECX1") \
+    X(XSAVES,           LEAFD_1_EAX,    3,  "XSAVES") \
+    X(LAHF_LM,          EXTENDED_ECX,   0,  "LAHF-SAHF") \
+    X(CMP_LEGACY,       EXTENDED_ECX,   1,  "CMP-Legacy") \
+    X(SVM,              EXTENDED_ECX,   2,  "SVM") \
+    X(ABM,              EXTENDED_ECX,   5,  "LZCNT") \
+    X(SSE4A,            EXTENDED_ECX,   6,  "SSE4A") \
+    X(PREFETCHW,        EXTENDED_ECX,   8,  "PREFETCHW") \
+    X(XOP,              EXTENDED_ECX,   11, "XOP") \
+    X(FMA4,             EXTENDED_ECX,   16, "FMA4") \
+    X(TBM,              EXTENDED_ECX,   21, "TBM") \
+    X(TOPOEXT,          EXTENDED_ECX,   22, "TOPOEXT") \
+    X(SYSCALL,          EXTENDED_EDX,   11, "SYSCALL") \
+    X(NX,               EXTENDED_EDX,   20, "NX") \
+    X(MMXEXT,           EXTENDED_EDX,   22, "MMXEXT") \
+    X(PDPE1GB,          EXTENDED_EDX,   26, "Page1GB") \
+    X(RDTSCP,           EXTENDED_EDX,   27, "RDTSCP") \
+    X(LM,               EXTENDED_EDX,   29, "LM") \
+    X(3DNOWEXT,         EXTENDED_EDX,   30, "3DNowExt") \
+    X(3DNOW,            EXTENDED_EDX,   31, "3DNow") \
+    X(INVARIANT_TSC,    POWER_EDX,      8,  "InvariantTSC")
+
+#define X64_FEATURE_ENUM_ENTRY(name, slot, bit, displayName) \
+    X64_FEATURE_##name = X64_FEATURE_SLOT_##slot * 32 + bit,
+
+enum X64Feature {
+    X64_FEATURE_LIST(X64_FEATURE_ENUM_ENTRY)
+};
+
+struct X64FeatureSet {
+    uint64_t    words[X64_FEATURE_WORDS];
+} __attribute__((aligned(16)));
+
+#define X64_MAX_LEAF2_DESCRIPTORS   15
+#define X64_MAX_CACHES              8
+#define X64_MAX_TLBS                16
+
 enum CpuidProcessorType {
     CPUID_PROCESSOR_TYPE_ORIGINAL_OEM       = 0,
     CPUID_PROCESSOR_TYPE_INTEL_OVERDRIVE    = 1,
@@ -79,6 +446,71 @@ enum CpuidProcessorType {
     CPUID_PROCESSOR_TYPE_RESERVED           = 3,
 };
 
+enum X64CacheType {
+    X64_CACHE_TYPE_NULL         = 0,
+    X64_CACHE_TYPE_DATA         = 1,
+    X64_CACHE_TYPE_INSTRUCTION  = 2,
+    X64_CACHE_TYPE_UNIFIED      = 3,
+};
+
+// One cache as described by deterministic cache parameters (leaf 4 or 0x8000001D)
+struct X64CacheInfo {
+    uint8_t     level;
+    uint8_t     type;
+    bool        selfInitializing;
+    bool        fullyAssociative;
+    // Cache is inclusive of lower cache levels
+    bool        inclusive;
+    bool        complexIndexing;
+    uint16_t    lineSize;
+    uint16_t    partitions;
+    uint16_t    ways;
+    uint32_t    sets;
+    uint32_t    sizeBytes;
+    // Maximum number of addressable logical processor IDs sharing this cache
+    uint16_t    maxThreadsSharing;
+};
+
+// Leaf 0xD subleaf n, for state component n
+struct X64XsaveComponent {
+    uint32_t    size;
+    // Offset in the standard format, 0 for supervisor components which only
+    // exist in the compacted format
+    uint32_t    offset;
+    // Managed through IA32_XSS by the OS, never saved by XSAVE or XSAVEC
+    bool        supervisor;
+    // Starts on a 64 byte boundary in the compacted format
+    bool        aligned;
+};
+
+// Leaf 0x18 EDX[4:0]
+enum X64TlbType {
+    X64_TLB_TYPE_NULL           = 0,
+    X64_TLB_TYPE_DATA           = 1,
+    X64_TLB_TYPE_INSTRUCTION    = 2,
+    X64_TLB_TYPE_UNIFIED        = 3,
+    X64_TLB_TYPE_LOAD_ONLY      = 4,
+    X64_TLB_TYPE_STORE_ONLY     = 5,
+};
+
+// Page sizes a TLB holds, leaf 0x18 EBX[3:0]
+#define X64_TLB_PAGE_4K         1
+#define X64_TLB_PAGE_2M         (1 << 1)
+#define X64_TLB_PAGE_4M         (1 << 2)
+#define X64_TLB_PAGE_1G         (1 << 3)
+
+struct X64TlbInfo {
+    uint8_t     level;
+    uint8_t     type;
+    // X64_TLB_PAGE_* flags
+    uint8_t     pageSizes;
+    bool        fullyAssociative;
+    // 0 if the source does not report the associativity
+    uint16_t    ways;
+    uint16_t    maxThreadsSharing;
+    uint32_t    entries;
+};
+
 struct X64Info {
     // Leaf 0
     uint32_t    maxInputBasicInfo;
@@ -97,10 +529,95 @@ struct X64Info {
     uint32_t    feature1;
     uint32_t    feature2;
     char        brandString[CPUID_BRAND_STRING_SIZE];
+    // XCR0, only read if the OS has set CR4.OSXSAVE
+    uint64_t    xcr0;
+    // Leaf 2
+    uint8_t     leaf2DescriptorCount;
+    uint8_t     leaf2Descriptors[X64_MAX_LEAF2_DESCRIPTORS];
+    // Leaf 4 or 0x8000001D
+    uint32_t    cacheLeaf;
+    uint32_t    cacheCount;
+    struct X64CacheInfo caches[X64_MAX_CACHES];
+    // Leaf 0x18, leaf 2 descriptors or 0x80000005/0x80000006/0x80000019
+    uint32_t    tlbLeaf;
+    uint32_t    tlbCount;
+    struct X64TlbInfo tlbs[X64_MAX_TLBS];
+    // Leaf 7 subleaf 0
+    uint32_t    maxStructuredSubleaf;
+    uint32_t    structuredFeature1;
+    uint32_t    structuredFeature2;
+    uint32_t    structuredFeature3;
+    // Leaf 7 subleaf 1
+    uint32_t    structuredFeature4;
+    // Leaf 0xA, all 0 without an architectural PMU (e.g. most VMs)
+    uint8_t     pmuVersion;
+    uint8_t     pmuCounters;
+    uint8_t     pmuCounterWidth;
+    // X64_PMU_EVENT_* flags
+    uint32_t    pmuEvents;
+    uint8_t     pmuFixedCounters;
+    uint8_t     pmuFixedCounterWidth;
+    // Bit i set if fixed counter i exists. Versions before 5 only report a
+    // count, which is turned into a contiguous mask
+    uint32_t    pmuFixedCounterMask;
+    // Leaf 0x15, the TSC runs at crystalHz * tscNumerator / tscDenominator.
+    // Any of them may be 0 when the CPU does not enumerate it
+    uint32_t    tscDenominator;
+    uint32_t    tscNumerator;
+    uint32_t    crystalHz;
+    // Leaf 0x16
+    uint16_t    baseMhz;
+    uint16_t    maxMhz;
+    uint16_t    busMhz;
+    // Leaf 0xD subleaf 0
+    uint64_t    xsaveSupportedComponents;
+    uint32_t    xsaveEnabledSize;
+    uint32_t    xsaveMaxSize;
+    // Leaf 0xD subleaf 1
+    uint32_t    xsaveFeatures;
+    // Compacted size of all components enabled in XCR0 | IA32_XSS
+    uint32_t    xsaveCompactedSize;
+    uint64_t    xsaveSupervisorComponents;
+    // Leaf 0xD subleaves 2 and up, indexed by component. Components 0 and 1
+    // are filled in with their fixed legacy region layout
+    struct X64XsaveComponent xsaveComponents[X64_MAX_XSAVE_COMPONENTS];
+    // X64_USABLE_* flags derived from the leaves above and XCR0
+    uint32_t    usableFeatures;
+    // All feature registers above at their stable bit indexes
+    struct X64FeatureSet features;
 
     bool        hasExtendedInfo;
     uint32_t    maxExtendedLeaf;
+    // Leaf 0x80000001
+    uint32_t    extendedFeature1;
+    uint32_t    extendedFeature2;
+    // Leaf 0x80000007 EDX
+    uint32_t    powerFeatures;
+    // Leaf 0x80000008 ECX: logical processors per package and the number of
+    // APIC ID bits below the package, 0 if not reported
+    uint32_t    packageThreads;
+    uint8_t     apicIdCoreIdSize;
+    // Leaf 0x8000001E of the decoding CPU, only read with TOPOEXT. A compute
+    // unit is a core on Zen, a node is a memory controller domain
+    uint32_t    extendedApicId;
+    uint8_t     computeUnitId;
+    uint8_t     threadsPerComputeUnit;
+    uint8_t     nodeId;
+    uint8_t     nodesPerPackage;
 
+    // Leaf 0x40000000, only read if CPUID.1:ECX.HYPERVISOR is set
+    enum X64Hypervisor hypervisor;
+    uint32_t    hypervisorMaxLeaf;
+    char        hypervisorVendor[CPUID_VENDOR_STRING_SIZE + 1];
+    // Paravirt features and hints: X64_KVM_FEATURE_* and X64_KVM_HINT_* from
+    // leaf 0x40000001 EAX/EDX, or X64_HYPERV_FEATURE_* and X64_HYPERV_HINT_*
+    // from leaves 0x40000003/0x40000004 EAX
+    uint32_t    hypervisorFeatures;
+    uint32_t    hypervisorHints;
+    // Hyper-V leaf 0x40000004 EBX
+    uint32_t    hypervisorSpinRetries;
+    // Leaf 0x40000010 EAX, TSC frequency as reported by VMware and KVM
+    uint32_t    hypervisorTscKhz;
 };
 
 struct X64CpuidResult {
@@ -111,20 +628,128 @@ struct X64CpuidResult {
 };
 
 // TODO: this function might be optimized out by the compiler
-void executeCpuidWithLeaf(uint32_t leaf, struct X64CpuidResult* result) {
+void executeCpuidWithSubleaf(uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
     asm(
         "mov eax, %4                \n"
+        "mov ecx, %5                \n"
         "cpuid                      \n"
         "mov %0, eax                \n"
         "mov %1, ebx                \n"
         "mov %2, ecx                \n"
         "mov %3, edx                \n"
         : "=m" (result->eax), "=m" (result->ebx), "=m" (result->ecx), "=m" (result->edx)
-        : "m" (leaf)
+        : "m" (leaf), "m" (subleaf)
         : "eax", "ebx", "ecx", "edx"
     );
 }
 
+void executeCpuidWithLeaf(uint32_t leaf, struct X64CpuidResult* result) {
+    executeCpuidWithSubleaf(leaf, 0, result);
+}
+
+// Must only be executed if CPUID.1:ECX.OSXSAVE is set, otherwise raises #UD
+uint64_t x64ReadXcr0() {
+    uint32_t eax = 0;
+    uint32_t edx = 0;
+    asm(
+        "xor ecx, ecx               \n"
+        "xgetbv                     \n"
+        "mov %0, eax                \n"
+        "mov %1, edx                \n"
+        : "=m" (eax), "=m" (edx)
+        :
+        : "eax", "ecx", "edx"
+    );
+    return ((uint64_t)edx << 32) | eax;
+}
+
+// -------------------------------------------------
+//                      Backends
+// -------------------------------------------------
+
+// Not a real leaf: backends return XCR0 in EAX (low) and EDX (high) for it, so
+// recorded captures carry the OS enabled state components along with CPUID
+#define X64_PSEUDO_LEAF_XCR0    0xFFFFFFFF
+
+// The Linux cpuid driver (/dev/cpu/N/cpuid) returns leaf, subleaf at file
+// offset subleaf << 32 | leaf. Stand-in trees of regular files used in tests
+// cannot address bytes that way, they store each 16 byte record at this many
+// times the device offset instead. A tree also carries XCR0 of the CPU it was
+// captured on, as the X64_PSEUDO_LEAF_XCR0 record
+#define X64_CPUID_TREE_STRIDE   16
+
+// Source of raw leaf registers for the decoder. The native backend executes
+// CPUID on the calling CPU, others replay captures or read other CPUs
+struct X64CpuidBackend {
+    void    (*query)(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result);
+    void*   ctx;
+};
+
+static void x64NativeQuery(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
+    if (leaf == X64_PSEUDO_LEAF_XCR0) {
+        uint64_t xcr0 = x64ReadXcr0();
+        *result = (struct X64CpuidResult){ .eax = (uint32_t)xcr0, .edx = (uint32_t)(xcr0 >> 32) };
+        return;
+    }
+    executeCpuidWithSubleaf(leaf, subleaf, result);
+}
+
+const struct X64CpuidBackend x64NativeBackend = { x64NativeQuery, 0 };
+
+static inline void x64BackendCpuid(const struct X64CpuidBackend* backend, uint32_t leaf, uint32_t subleaf,
+                                   struct X64CpuidResult* result) {
+    backend->query(backend->ctx, leaf, subleaf, result);
+}
+
+#define X64_MAX_SUBLEAVES   64
+
+// Number of valid subleaves of a leaf, following the enumeration rule each
+// subleaf-indexed leaf documents. Leaves without subleaves return 1
+uint32_t x64GetSubleafCount(const struct X64CpuidBackend* backend, uint32_t leaf) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, leaf, 0, &result);
+
+    uint32_t count = 1;
+    switch (leaf) {
+    case 0x4:
+    case 0x8000001D:
+        // Terminated by the null cache type, which is included
+        while (count < X64_MAX_SUBLEAVES && (result.eax & 0b11111) != 0) {
+            x64BackendCpuid(backend, leaf, count, &result);
+            count++;
+        }
+        return count;
+    case 0xB:
+    case 0x1F:
+    case 0x80000026:
+        // Terminated by the invalid level type, which is included
+        while (count < X64_MAX_SUBLEAVES && ((result.ecx >> 8) & 0xFF) != 0) {
+            x64BackendCpuid(backend, leaf, count, &result);
+            count++;
+        }
+        return count;
+    case 0x7:
+    case 0x14:
+    case 0x17:
+    case 0x18:
+    case 0x1D:
+    case 0x20:
+        // Subleaf 0 EAX reports the highest valid subleaf
+        count = result.eax + 1;
+        break;
+    case 0xD:
+        // One subleaf per XSAVE state component
+        count = 63;
+        break;
+    case 0xF:
+    case 0x10:
+    case 0x12:
+        count = 4;
+        break;
+    }
+    return count < X64_MAX_SUBLEAVES ? count : X64_MAX_SUBLEAVES;
+}
+
 // Returns true if the brand index is valid and points brandString to the correct brand name
 // otherwise returns false
 bool x64TranslateBrandIndex(uint8_t brandIndex, char** brandString) {
@@ -282,70 +907,564 @@ bool x64TranslateLeaf2Descriptor(uint8_t d, char** t) {
 }
 
 
+#define X64_FEATURE_NAME_ENTRY(name, slot, bit, displayName) \
+    [X64_FEATURE_##name] = displayName,
+
+// Display name of every known feature bit, 0 for reserved bits
+static const char* const x64FeatureNames[X64_FEATURE_BITS] = {
+    X64_FEATURE_LIST(X64_FEATURE_NAME_ENTRY)
+};
+
+// Returns the feature index for a display name, or -1 if unknown
+int32_t x64FindFeatureByName(const char* name) {
+    for (uint32_t feature = 0; feature < X64_FEATURE_BITS; feature++) {
+        if (x64FeatureNames[feature] && strcmp(x64FeatureNames[feature], name) == 0) {
+            return feature;
+        }
+    }
+    return -1;
+}
+
+static inline bool x64FeatureSetHas(const struct X64FeatureSet* set, uint32_t feature) {
+    return (set->words[feature / 64] >> (feature % 64)) & 1;
+}
+
+static inline void x64FeatureSetAdd(struct X64FeatureSet* set, uint32_t feature) {
+    set->words[feature / 64] |= 1ull << (feature % 64);
+}
+
+static inline void x64FeatureSetSlot(struct X64FeatureSet* set, enum X64FeatureSlot slot, uint32_t value) {
+    uint32_t shift = (slot % 2) * 32;
+    set->words[slot / 2] = (set->words[slot / 2] & ~(0xFFFFFFFFull << shift)) | ((uint64_t)value << shift);
+}
+
+void x64BuildFeatureSet(const struct X64Info* cpuid, struct X64FeatureSet* set) {
+    *set = (struct X64FeatureSet){};
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF1_ECX, cpuid->feature1);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF1_EDX, cpuid->feature2);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF7_EBX, cpuid->structuredFeature1);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF7_ECX, cpuid->structuredFeature2);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF7_EDX, cpuid->structuredFeature3);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAF7_1_EAX, cpuid->structuredFeature4);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_LEAFD_1_EAX, cpuid->xsaveFeatures);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_EXTENDED_ECX, cpuid->extendedFeature1);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_EXTENDED_EDX, cpuid->extendedFeature2);
+    x64FeatureSetSlot(set, X64_FEATURE_SLOT_POWER_EDX, cpuid->powerFeatures);
+}
+
+// The set operations work on 128 bit lanes. SSE2 is part of the x86-64
+// baseline, so they need no dispatch and the compiler keeps them in registers
+
+void x64FeatureSetUnion(const struct X64FeatureSet* a, const struct X64FeatureSet* b, struct X64FeatureSet* out) {
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS; i += 2) {
+        __m128i x = _mm_load_si128((const __m128i*)&a->words[i]);
+        __m128i y = _mm_load_si128((const __m128i*)&b->words[i]);
+        _mm_store_si128((__m128i*)&out->words[i], _mm_or_si128(x, y));
+    }
+}
+
+void x64FeatureSetIntersect(const struct X64FeatureSet* a, const struct X64FeatureSet* b, struct X64FeatureSet* out) {
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS; i += 2) {
+        __m128i x = _mm_load_si128((const __m128i*)&a->words[i]);
+        __m128i y = _mm_load_si128((const __m128i*)&b->words[i]);
+        _mm_store_si128((__m128i*)&out->words[i], _mm_and_si128(x, y));
+    }
+}
+
+// out = features in a that are missing from b
+void x64FeatureSetDiff(const struct X64FeatureSet* a, const struct X64FeatureSet* b, struct X64FeatureSet* out) {
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS; i += 2) {
+        __m128i x = _mm_load_si128((const __m128i*)&a->words[i]);
+        __m128i y = _mm_load_si128((const __m128i*)&b->words[i]);
+        _mm_store_si128((__m128i*)&out->words[i], _mm_andnot_si128(y, x));
+    }
+}
+
+// True if every feature of a is also in b
+bool x64FeatureSetIsSubset(const struct X64FeatureSet* a, const struct X64FeatureSet* b) {
+    __m128i missing = _mm_setzero_si128();
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS; i += 2) {
+        __m128i x = _mm_load_si128((const __m128i*)&a->words[i]);
+        __m128i y = _mm_load_si128((const __m128i*)&b->words[i]);
+        missing = _mm_or_si128(missing, _mm_andnot_si128(y, x));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xFFFF;
+}
+
+// Intersection of count sets, e.g. the features common to a whole fleet.
+// Keeps the accumulator in registers for the entire pass
+void x64FeatureSetIntersectMany(const struct X64FeatureSet* sets, size_t count, struct X64FeatureSet* out) {
+    __m128i acc[X64_FEATURE_WORDS / 2];
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+        acc[i] = _mm_set1_epi32(-1);
+    }
+    for (size_t s = 0; s < count; s++) {
+        const __m128i* words = (const __m128i*)sets[s].words;
+        for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+            acc[i] = _mm_and_si128(acc[i], _mm_load_si128(&words[i]));
+        }
+    }
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+        _mm_store_si128((__m128i*)&out->words[i * 2], acc[i]);
+    }
+}
+
+void x64FeatureSetUnionMany(const struct X64FeatureSet* sets, size_t count, struct X64FeatureSet* out) {
+    __m128i acc[X64_FEATURE_WORDS / 2];
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+        acc[i] = _mm_setzero_si128();
+    }
+    for (size_t s = 0; s < count; s++) {
+        const __m128i* words = (const __m128i*)sets[s].words;
+        for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+            acc[i] = _mm_or_si128(acc[i], _mm_load_si128(&words[i]));
+        }
+    }
+    for (uint32_t i = 0; i < X64_FEATURE_WORDS / 2; i++) {
+        _mm_store_si128((__m128i*)&out->words[i * 2], acc[i]);
+    }
+}
+
+void x64PrintUsableFeatures(struct X64Info* cpuid) {
+    uint32_t usable = cpuid->usableFeatures;
+    if (usable & X64_USABLE_SSE)                printf("\tSSE\n");
+    if (usable & X64_USABLE_SSE2)               printf("\tSSE2\n");
+    if (usable & X64_USABLE_SSE3)               printf("\tSSE3\n");
+    if (usable & X64_USABLE_SSSE3)              printf("\tSSSE3\n");
+    if (usable & X64_USABLE_SSE4_1)             printf("\tSSE4.1\n");
+    if (usable & X64_USABLE_SSE4_2)             printf("\tSSE4.2\n");
+    if (usable & X64_USABLE_AVX)                printf("\tAVX\n");
+    if (usable & X64_USABLE_F16C)               printf("\tF16C\n");
+    if (usable & X64_USABLE_FMA)                printf("\tFMA\n");
+    if (usable & X64_USABLE_AVX2)               printf("\tAVX2\n");
+    if (usable & X64_USABLE_AVX512F)            printf("\tAVX512F\n");
+    if (usable & X64_USABLE_AVX512CD)           printf("\tAVX512CD\n");
+    if (usable & X64_USABLE_AVX512BW)           printf("\tAVX512BW\n");
+    if (usable & X64_USABLE_AVX512DQ)           printf("\tAVX512DQ\n");
+    if (usable & X64_USABLE_AVX512VL)           printf("\tAVX512VL\n");
+    if (usable & X64_USABLE_AVX512_IFMA)        printf("\tAVX512_IFMA\n");
+    if (usable & X64_USABLE_AVX512_VBMI)        printf("\tAVX512_VBMI\n");
+    if (usable & X64_USABLE_AVX512_VBMI2)       printf("\tAVX512_VBMI2\n");
+    if (usable & X64_USABLE_AVX512_VNNI)        printf("\tAVX512_VNNI\n");
+    if (usable & X64_USABLE_AVX512_BITALG)      printf("\tAVX512_BITALG\n");
+    if (usable & X64_USABLE_AVX512_VPOPCNTDQ)   printf("\tAVX512_VPOPCNTDQ\n");
+    if (usable & X64_USABLE_AVX512_FP16)        printf("\tAVX512_FP16\n");
+    if (usable & X64_USABLE_VAES)               printf("\tVAES\n");
+    if (usable & X64_USABLE_VPCLMULQDQ)         printf("\tVPCLMULQDQ\n");
+    if (usable & X64_USABLE_GFNI)               printf("\tGFNI\n");
+    if (usable & X64_USABLE_AMX_TILE)           printf("\tAMX-TILE\n");
+    if (usable & X64_USABLE_AMX_INT8)           printf("\tAMX-INT8\n");
+    if (usable & X64_USABLE_AMX_BF16)           printf("\tAMX-BF16\n");
+}
+
 void x64PrintFeatureSet(struct X64Info* cpuid) {
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE3)            printf("\tSSE3\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_PCLMULQDQ)       printf("\tPCLMULQDQ\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_DTES64)          printf("\tDTES64\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_MONITOR)         printf("\tMONITOR\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_DS_CPL)          printf("\tDS-CPL\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_VMX)             printf("\tVMX\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SMX)             printf("\tSMX\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_EIST)            printf("\tEIST\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_TM2)             printf("\tTM2\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSSE2)           printf("\tSSSE3\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_CNXT_ID)         printf("\tCNXT-ID\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SDBG)            printf("\tSDBG\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_FMA)             printf("\tFMA\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_CMPXCHG16B)      printf("\tCMPXCHG16B\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_XTPR)            printf("\txTPR\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_PDCM)            printf("\tPDCM\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_PCID)            printf("\tPCID\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_DCA)             printf("\tDCA\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE4_1)          printf("\tSSE4.1\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE4_2)          printf("\tSSE4.2\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_X2APIC)          printf("\tx2APIC\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_MOVBE)           printf("\tMOVBE\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_POPCNT)          printf("\tPOPCNT\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_TSC_DEADLINE)    printf("\tTSC-Deadline\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_AES)             printf("\tAES\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_XSAVE)           printf("\tXSAVE\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_OSXSAVE)         printf("\tOSXSAVE\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_AVX)             printf("\tAVX\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_F16C)            printf("\tF16C\n");
-    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_RDRAND)          printf("\tRDRAND\n");
-
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PBE)     printf("\tPBE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_TM)      printf("\tTM\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_HTT)     printf("\tHTT\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SS)      printf("\tSS\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SSE2)    printf("\tSSE2\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SSE)     printf("\tSSE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_FXSR)    printf("\tFXSR\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_MMX)     printf("\tMMX\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_ACPI)    printf("\tACPI\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_DS)      printf("\tDS\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_CLFSH)   printf("\tCLFSH\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PSN)     printf("\tPSN\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PSE_36)  printf("\tPSE-36\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PAT)     printf("\tPAT\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_CMOV)    printf("\tCMOV\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_MCA)     printf("\tMCA\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PGE)     printf("\tPGE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_MTRR)    printf("\tMTRR\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SEP)     printf("\tSEP\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_APIC)    printf("\tAPIC\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_CX8)     printf("\tCX8\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_MCE)     printf("\tMCE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PAE)     printf("\tPAE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_MSR)     printf("\tMSR\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_TSC)     printf("\tTSC\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_PSE)     printf("\tPSE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_DE)      printf("\tDE\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_VME)     printf("\tVME\n");
-    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_FPU)     printf("\tFPU\n");
+    for (uint32_t feature = 0; feature < X64_FEATURE_BITS; feature++) {
+        if (x64FeatureSetHas(&cpuid->features, feature) && x64FeatureNames[feature]) {
+            printf("\t%s\n", x64FeatureNames[feature]);
+        }
+    }
 }
 
-bool getCpuidInfo(struct X64Info* cpuid) {
+// -------------------------------------------------
+//                      TLBs
+// -------------------------------------------------
+
+// Structured form of the leaf 2 TLB descriptors. Descriptors that describe two
+// arrays appear twice
+static const struct {
+    uint8_t     descriptor;
+    uint8_t     level;
+    uint8_t     type;
+    uint8_t     pageSizes;
+    // 0 for fully associative
+    uint16_t    ways;
+    uint16_t    entries;
+} x64Leaf2Tlbs[] = {
+    { 0x01, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       4,  32 },
+    { 0x02, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4M,                                       0,  2 },
+    { 0x03, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  64 },
+    { 0x04, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4M,                                       4,  8 },
+    { 0x05, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4M,                                       4,  32 },
+    { 0x0B, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4M,                                       4,  4 },
+    { 0x4F, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       0,  32 },
+    { 0x50, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K | X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,   0,  64 },
+    { 0x51, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K | X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,   0,  128 },
+    { 0x52, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K | X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,   0,  256 },
+    { 0x55, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     0,  7 },
+    { 0x56, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4M,                                       4,  16 },
+    { 0x57, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  16 },
+    { 0x59, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       0,  16 },
+    { 0x5A, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     4,  32 },
+    { 0x5B, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K | X64_TLB_PAGE_4M,                     0,  64 },
+    { 0x5C, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K | X64_TLB_PAGE_4M,                     0,  128 },
+    { 0x5D, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K | X64_TLB_PAGE_4M,                     0,  256 },
+    { 0x61, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       0,  48 },
+    { 0x63, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     4,  32 },
+    { 0x63, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_1G,                                       4,  4 },
+    { 0x64, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  512 },
+    { 0x6A, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       8,  64 },
+    { 0x6B, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       8,  256 },
+    { 0x6C, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     8,  128 },
+    { 0x6D, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_1G,                                       0,  16 },
+    { 0x76, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     0,  8 },
+    { 0xA0, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       0,  32 },
+    { 0xB0, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       4,  128 },
+    { 0xB1, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_2M,                                       4,  8 },
+    { 0xB2, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       4,  64 },
+    { 0xB3, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  128 },
+    { 0xB4, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  256 },
+    { 0xB5, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       8,  64 },
+    { 0xB6, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K,                                       8,  128 },
+    { 0xBA, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K,                                       4,  64 },
+    { 0xC0, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K | X64_TLB_PAGE_4M,                     4,  8 },
+    { 0xC1, 2, X64_TLB_TYPE_UNIFIED,     X64_TLB_PAGE_4K | X64_TLB_PAGE_2M,                     8,  1024 },
+    { 0xC2, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_4K | X64_TLB_PAGE_2M,                     4,  16 },
+    { 0xC3, 2, X64_TLB_TYPE_UNIFIED,     X64_TLB_PAGE_4K | X64_TLB_PAGE_2M,                     6,  1536 },
+    { 0xC3, 2, X64_TLB_TYPE_UNIFIED,     X64_TLB_PAGE_1G,                                       4,  16 },
+    { 0xC4, 1, X64_TLB_TYPE_DATA,        X64_TLB_PAGE_2M | X64_TLB_PAGE_4M,                     4,  32 },
+    { 0xCA, 2, X64_TLB_TYPE_UNIFIED,     X64_TLB_PAGE_4K,                                       4,  512 },
+};
+
+static void x64AddTlb(struct X64Info* cpuid, uint8_t level, uint8_t type, uint8_t pageSizes,
+                      uint16_t ways, bool fullyAssociative, uint32_t entries) {
+    if (cpuid->tlbCount == X64_MAX_TLBS || entries == 0) {
+        return;
+    }
+    struct X64TlbInfo* tlb = &cpuid->tlbs[cpuid->tlbCount++];
+    tlb->level = level;
+    tlb->type = type;
+    tlb->pageSizes = pageSizes;
+    tlb->ways = ways;
+    tlb->fullyAssociative = fullyAssociative;
+    tlb->maxThreadsSharing = 0;
+    tlb->entries = entries;
+}
+
+// Walks the subleaves of leaf 0x18. Unlike leaf 4, invalid subleaves may be
+// followed by valid ones, so all subleaves up to the reported maximum are read
+void x64DecodeTlbLeaf(const struct X64CpuidBackend* backend, struct X64Info* cpuid) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0x18, 0, &result);
+    const uint32_t maxSubleaf = result.eax < X64_MAX_SUBLEAVES ? result.eax : X64_MAX_SUBLEAVES - 1;
+
+    for (uint32_t subleaf = 0; subleaf <= maxSubleaf; subleaf++) {
+        if (subleaf > 0) {
+            x64BackendCpuid(backend, 0x18, subleaf, &result);
+        }
+        uint8_t type = result.edx & 0b11111;
+        if (type == X64_TLB_TYPE_NULL || cpuid->tlbCount == X64_MAX_TLBS) {
+            continue;
+        }
+
+        struct X64TlbInfo* tlb = &cpuid->tlbs[cpuid->tlbCount++];
+        tlb->type              = type;
+        tlb->level             = (result.edx >> 5) & 0b111;
+        tlb->fullyAssociative  = (result.edx >> 8) & 1;
+        tlb->maxThreadsSharing = ((result.edx >> 14) & 0xFFF) + 1;
+        tlb->pageSizes         = result.ebx & 0xF;
+        tlb->ways              = result.ebx >> 16;
+        tlb->entries           = (uint32_t)tlb->ways * result.ecx;
+    }
+    if (cpuid->tlbCount > 0) {
+        cpuid->tlbLeaf = 0x18;
+    }
+}
+
+void x64DecodeLeaf2Tlbs(struct X64Info* cpuid) {
+    for (uint32_t i = 0; i < cpuid->leaf2DescriptorCount; i++) {
+        for (uint32_t t = 0; t < sizeof(x64Leaf2Tlbs) / sizeof(x64Leaf2Tlbs[0]); t++) {
+            if (x64Leaf2Tlbs[t].descriptor != cpuid->leaf2Descriptors[i]) {
+                continue;
+            }
+            x64AddTlb(cpuid, x64Leaf2Tlbs[t].level, x64Leaf2Tlbs[t].type, x64Leaf2Tlbs[t].pageSizes,
+                      x64Leaf2Tlbs[t].ways, x64Leaf2Tlbs[t].ways == 0, x64Leaf2Tlbs[t].entries);
+        }
+    }
+    if (cpuid->tlbCount > 0) {
+        cpuid->tlbLeaf = 2;
+    }
+}
+
+// AMD's 4 bit associativity encoding of leaves 0x80000006 and 0x80000019
+static uint16_t x64DecodeAmdWays(uint32_t encoded) {
+    static const uint16_t ways[16] = { 0, 1, 2, 3, 4, 6, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0 };
+    return ways[encoded & 0xF];
+}
+
+// Adds the data and instruction TLB of one AMD L2 or 1G register. The
+// instruction fields are 0 when the TLB is unified
+static void x64AddAmdL2Tlbs(struct X64Info* cpuid, uint8_t level, uint8_t pageSizes, uint32_t reg) {
+    const uint32_t dataWays = reg >> 28;
+    const uint32_t instructionWays = (reg >> 12) & 0xF;
+    const uint8_t dataType = instructionWays == 0 ? X64_TLB_TYPE_UNIFIED : X64_TLB_TYPE_DATA;
+    if (dataWays != 0) {
+        x64AddTlb(cpuid, level, dataType, pageSizes, x64DecodeAmdWays(dataWays), dataWays == 0xF, (reg >> 16) & 0xFFF);
+    }
+    if (instructionWays != 0) {
+        x64AddTlb(cpuid, level, X64_TLB_TYPE_INSTRUCTION, pageSizes, x64DecodeAmdWays(instructionWays),
+                  instructionWays == 0xF, reg & 0xFFF);
+    }
+}
+
+void x64DecodeAmdTlbs(const struct X64CpuidBackend* backend, struct X64Info* cpuid) {
+    struct X64CpuidResult result = {};
+    const uint8_t largePages = X64_TLB_PAGE_2M | X64_TLB_PAGE_4M;
+
+    // L1 associativity is the raw way count, 0xFF for fully associative
+    x64BackendCpuid(backend, 0x80000005, 0, &result);
+    x64AddTlb(cpuid, 1, X64_TLB_TYPE_DATA, X64_TLB_PAGE_4K, (result.ebx >> 24) & 0xFF,
+              ((result.ebx >> 24) & 0xFF) == 0xFF, (result.ebx >> 16) & 0xFF);
+    x64AddTlb(cpuid, 1, X64_TLB_TYPE_INSTRUCTION, X64_TLB_PAGE_4K, (result.ebx >> 8) & 0xFF,
+              ((result.ebx >> 8) & 0xFF) == 0xFF, result.ebx & 0xFF);
+    x64AddTlb(cpuid, 1, X64_TLB_TYPE_DATA, largePages, (result.eax >> 24) & 0xFF,
+              ((result.eax >> 24) & 0xFF) == 0xFF, (result.eax >> 16) & 0xFF);
+    x64AddTlb(cpuid, 1, X64_TLB_TYPE_INSTRUCTION, largePages, (result.eax >> 8) & 0xFF,
+              ((result.eax >> 8) & 0xFF) == 0xFF, result.eax & 0xFF);
+
+    if (cpuid->maxExtendedLeaf >= 0x80000006) {
+        x64BackendCpuid(backend, 0x80000006, 0, &result);
+        x64AddAmdL2Tlbs(cpuid, 2, X64_TLB_PAGE_4K, result.ebx);
+        x64AddAmdL2Tlbs(cpuid, 2, largePages, result.eax);
+    }
+    if (cpuid->maxExtendedLeaf >= 0x80000019) {
+        x64BackendCpuid(backend, 0x80000019, 0, &result);
+        x64AddAmdL2Tlbs(cpuid, 1, X64_TLB_PAGE_1G, result.eax);
+        x64AddAmdL2Tlbs(cpuid, 2, X64_TLB_PAGE_1G, result.ebx);
+    }
+    if (cpuid->tlbCount > 0) {
+        cpuid->tlbLeaf = 0x80000005;
+    }
+}
+
+// Walks the subleaves of leaf 4 or 0x8000001D until the null cache type and
+// stores each cache in cpuid->caches
+void x64DecodeDeterministicCaches(const struct X64CpuidBackend* backend, uint32_t leaf, struct X64Info* cpuid) {
+    for (uint32_t subleaf = 0; subleaf < X64_MAX_CACHES; subleaf++) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, leaf, subleaf, &result);
+
+        uint8_t type = result.eax & 0b11111;
+        if (type == X64_CACHE_TYPE_NULL) {
+            break;
+        }
+
+        struct X64CacheInfo* cache = &cpuid->caches[cpuid->cacheCount++];
+        cache->type              = type;
+        cache->level             = (result.eax >> 5) & 0b111;
+        cache->selfInitializing  = (result.eax >> 8) & 1;
+        cache->fullyAssociative  = (result.eax >> 9) & 1;
+        cache->maxThreadsSharing = ((result.eax >> 14) & 0xFFF) + 1;
+
+        cache->lineSize          = (result.ebx & 0xFFF) + 1;
+        cache->partitions        = ((result.ebx >> 12) & 0x3FF) + 1;
+        cache->ways              = ((result.ebx >> 22) & 0x3FF) + 1;
+        cache->sets              = result.ecx + 1;
+
+        cache->inclusive         = (result.edx >> 1) & 1;
+        cache->complexIndexing   = (result.edx >> 2) & 1;
+
+        cache->sizeBytes = (uint32_t)cache->ways * cache->partitions * cache->lineSize * cache->sets;
+    }
+    cpuid->cacheLeaf = leaf;
+}
+
+// Combines the CPUID feature bits with the state components the OS has enabled
+// in XCR0 (and that leaf 0xD reports as supported)
+uint32_t x64ComputeUsableFeatures(const struct X64Info* cpuid) {
+    uint32_t usable = 0;
+
+    // SSE state is always managed by a 64-bit OS through FXSAVE
+    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SSE)     usable |= X64_USABLE_SSE;
+    if (cpuid->feature2 & X64_FEATURE_FLAG_ECX_SSE2)    usable |= X64_USABLE_SSE2;
+    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE3)    usable |= X64_USABLE_SSE3;
+    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSSE3)   usable |= X64_USABLE_SSSE3;
+    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE4_1)  usable |= X64_USABLE_SSE4_1;
+    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_SSE4_2)  usable |= X64_USABLE_SSE4_2;
+
+    if (!(cpuid->feature1 & X64_FEATURE_FLAG_ECX_OSXSAVE)) {
+        return usable;
+    }
+
+    const uint64_t enabled = cpuid->xcr0 & cpuid->xsaveSupportedComponents;
+    const uint64_t ymmState = X64_XCR0_SSE | X64_XCR0_AVX;
+    const uint64_t zmmState = ymmState | X64_XCR0_OPMASK | X64_XCR0_ZMM_HI256 | X64_XCR0_HI16_ZMM;
+    const uint64_t tileState = X64_XCR0_XTILECFG | X64_XCR0_XTILEDATA;
+
+    if ((enabled & ymmState) == ymmState && (cpuid->feature1 & X64_FEATURE_FLAG_ECX_AVX)) {
+        usable |= X64_USABLE_AVX;
+        if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_F16C)                       usable |= X64_USABLE_F16C;
+        if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_FMA)                        usable |= X64_USABLE_FMA;
+        if (cpuid->structuredFeature1 & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX2)  usable |= X64_USABLE_AVX2;
+        if (cpuid->structuredFeature2 & X64_STRUCTURED_FEATURE_FLAG_ECX_VAES)  usable |= X64_USABLE_VAES;
+        if (cpuid->structuredFeature2 & X64_STRUCTURED_FEATURE_FLAG_ECX_VPCLMULQDQ) usable |= X64_USABLE_VPCLMULQDQ;
+        if (cpuid->structuredFeature2 & X64_STRUCTURED_FEATURE_FLAG_ECX_GFNI)  usable |= X64_USABLE_GFNI;
+    }
+
+    if ((enabled & zmmState) == zmmState && (cpuid->structuredFeature1 & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512F)) {
+        usable |= X64_USABLE_AVX512F;
+        const uint32_t ebx = cpuid->structuredFeature1;
+        const uint32_t ecx = cpuid->structuredFeature2;
+        const uint32_t edx = cpuid->structuredFeature3;
+        if (ebx & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512CD)             usable |= X64_USABLE_AVX512CD;
+        if (ebx & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512BW)             usable |= X64_USABLE_AVX512BW;
+        if (ebx & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512DQ)             usable |= X64_USABLE_AVX512DQ;
+        if (ebx & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512VL)             usable |= X64_USABLE_AVX512VL;
+        if (ebx & X64_STRUCTURED_FEATURE_FLAG_EBX_AVX512_IFMA)          usable |= X64_USABLE_AVX512_IFMA;
+        if (ecx & X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VBMI)          usable |= X64_USABLE_AVX512_VBMI;
+        if (ecx & X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VBMI2)         usable |= X64_USABLE_AVX512_VBMI2;
+        if (ecx & X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VNNI)          usable |= X64_USABLE_AVX512_VNNI;
+        if (ecx & X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_BITALG)        usable |= X64_USABLE_AVX512_BITALG;
+        if (ecx & X64_STRUCTURED_FEATURE_FLAG_ECX_AVX512_VPOPCNTDQ)     usable |= X64_USABLE_AVX512_VPOPCNTDQ;
+        if (edx & X64_STRUCTURED_FEATURE_FLAG_EDX_AVX512_FP16)          usable |= X64_USABLE_AVX512_FP16;
+    }
+
+    if ((enabled & tileState) == tileState && (cpuid->structuredFeature3 & X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_TILE)) {
+        usable |= X64_USABLE_AMX_TILE;
+        if (cpuid->structuredFeature3 & X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_INT8)  usable |= X64_USABLE_AMX_INT8;
+        if (cpuid->structuredFeature3 & X64_STRUCTURED_FEATURE_FLAG_EDX_AMX_BF16)  usable |= X64_USABLE_AMX_BF16;
+    }
+
+    return usable;
+}
+
+// Family as shown by the SDM, the extended family only counts for family 0xF
+uint32_t x64GetDisplayFamily(const struct X64Info* cpuid) {
+    if (cpuid->familyId == 0xF) {
+        return cpuid->extendedFamilyId + cpuid->familyId;
+    }
+    return cpuid->familyId;
+}
+
+// Model as shown by the SDM, the extended model only counts for families 0x6 and 0xF
+uint32_t x64GetDisplayModel(const struct X64Info* cpuid) {
+    if (cpuid->familyId == 0xF || cpuid->familyId == 0x6) {
+        return (cpuid->extendedModelId << 4) + cpuid->modelId;
+    }
+    return cpuid->modelId;
+}
+
+// Size of an XSAVE area holding the given state components. The standard
+// format (XSAVE, XSAVEOPT) keeps every component at its fixed offset, the
+// compacted format (XSAVEC, XSAVES) packs the requested components in order
+uint32_t x64GetXsaveSize(const struct X64Info* cpuid, uint64_t components, bool compacted) {
+    uint32_t size = X64_XSAVE_EXTENDED_OFFSET;
+    for (uint32_t i = 2; i < X64_MAX_XSAVE_COMPONENTS; i++) {
+        const struct X64XsaveComponent* component = &cpuid->xsaveComponents[i];
+        if (!(components & (1ull << i)) || component->size == 0) {
+            continue;
+        }
+        if (compacted) {
+            if (component->aligned) {
+                size = (size + 63) & ~63u;
+            }
+            size += component->size;
+        } else if (component->offset + component->size > size) {
+            size = component->offset + component->size;
+        }
+    }
+    return size;
+}
+
+// Offset of one component in an area holding components, or 0 if it is not part of it
+uint32_t x64GetXsaveOffset(const struct X64Info* cpuid, uint64_t components, uint32_t index, bool compacted) {
+    if (index >= X64_MAX_XSAVE_COMPONENTS || !(components & (1ull << index))) {
+        return 0;
+    }
+    if (!compacted || index < 2) {
+        return cpuid->xsaveComponents[index].offset;
+    }
+
+    uint32_t offset = X64_XSAVE_EXTENDED_OFFSET;
+    for (uint32_t i = 2; i <= index; i++) {
+        const struct X64XsaveComponent* component = &cpuid->xsaveComponents[i];
+        if (!(components & (1ull << i)) || component->size == 0) {
+            continue;
+        }
+        if (component->aligned) {
+            offset = (offset + 63) & ~63u;
+        }
+        if (i == index) {
+            break;
+        }
+        offset += component->size;
+    }
+    return offset;
+}
+
+// Smallest area that saves every user state component the OS has enabled,
+// using XSAVEC when available. Returns 0 if XSAVE is not enabled
+uint32_t x64GetXsaveAreaSize(const struct X64Info* cpuid, bool* compacted) {
+    *compacted = (cpuid->xsaveFeatures & X64_XSAVE_FEATURE_FLAG_EAX_XSAVEC) != 0;
+    if (!(cpuid->feature1 & X64_FEATURE_FLAG_ECX_OSXSAVE)) {
+        return 0;
+    }
+    return x64GetXsaveSize(cpuid, cpuid->xcr0 & cpuid->xsaveSupportedComponents, *compacted);
+}
+
+// TSC frequency in Hz from leaves 0x15 and 0x16, or 0 if the CPU does not
+// enumerate it. Some parts report the ratio but not the crystal, which is then
+// derived from the base frequency as the SDM suggests. Guests usually see
+// neither leaf, or a ratio with neither crystal nor base frequency, and use the
+// hypervisor timing leaf instead
+uint64_t x64GetTscFrequency(const struct X64Info* cpuid) {
+    if (cpuid->tscDenominator != 0 && cpuid->tscNumerator != 0) {
+        if (cpuid->crystalHz != 0) {
+            return (uint64_t)cpuid->crystalHz * cpuid->tscNumerator / cpuid->tscDenominator;
+        }
+        if (cpuid->baseMhz != 0) {
+            return (uint64_t)cpuid->baseMhz * 1000000;
+        }
+    }
+    return (uint64_t)cpuid->hypervisorTscKhz * 1000;
+}
+
+// x86-64 psABI microarchitecture level (1 to 4) the CPU can run, as used by
+// -march=x86-64-vN. Returns 0 if even the baseline is missing
+uint32_t x64GetMicroarchLevel(const struct X64Info* cpuid) {
+    const uint32_t v1Edx = X64_FEATURE_FLAG_ECX_CMOV | X64_FEATURE_FLAG_ECX_CX8 | X64_FEATURE_FLAG_ECX_FPU
+                         | X64_FEATURE_FLAG_ECX_FXSR | X64_FEATURE_FLAG_ECX_MMX;
+    const uint32_t v1Usable = X64_USABLE_SSE | X64_USABLE_SSE2;
+    const uint32_t v2Ecx = X64_FEATURE_FLAG_ECX_CMPXCHG16B | X64_FEATURE_FLAG_ECX_POPCNT;
+    const uint32_t v2Usable = X64_USABLE_SSE3 | X64_USABLE_SSSE3 | X64_USABLE_SSE4_1 | X64_USABLE_SSE4_2;
+    const uint32_t v3Ebx = X64_STRUCTURED_FEATURE_FLAG_EBX_BMI1 | X64_STRUCTURED_FEATURE_FLAG_EBX_BMI2;
+    const uint32_t v3Usable = X64_USABLE_AVX | X64_USABLE_AVX2 | X64_USABLE_F16C | X64_USABLE_FMA;
+    const uint32_t v4Usable = X64_USABLE_AVX512F | X64_USABLE_AVX512BW | X64_USABLE_AVX512CD
+                            | X64_USABLE_AVX512DQ | X64_USABLE_AVX512VL;
+    const struct X64FeatureSet* features = &cpuid->features;
+
+    if ((cpuid->feature2 & v1Edx) != v1Edx || (cpuid->usableFeatures & v1Usable) != v1Usable
+        || !x64FeatureSetHas(features, X64_FEATURE_SYSCALL) || !x64FeatureSetHas(features, X64_FEATURE_LM)) {
+        return 0;
+    }
+    if ((cpuid->feature1 & v2Ecx) != v2Ecx || (cpuid->usableFeatures & v2Usable) != v2Usable
+        || !x64FeatureSetHas(features, X64_FEATURE_LAHF_LM)) {
+        return 1;
+    }
+    if ((cpuid->structuredFeature1 & v3Ebx) != v3Ebx || (cpuid->usableFeatures & v3Usable) != v3Usable
+        || !(cpuid->feature1 & X64_FEATURE_FLAG_ECX_MOVBE) || !x64FeatureSetHas(features, X64_FEATURE_ABM)) {
+        return 2;
+    }
+    if ((cpuid->usableFeatures & v4Usable) != v4Usable) {
+        return 3;
+    }
+    return 4;
+}
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define X64_ARCH_REQ_XCOMP_PERM     0x1023
+#define X64_XFEATURE_XTILEDATA      18
+
+// Linux only hands out the large AMX tile state on request. Returns false if
+// the kernel refused or does not support AMX
+bool x64RequestAmxPermission() {
+    return syscall(SYS_arch_prctl, X64_ARCH_REQ_XCOMP_PERM, X64_XFEATURE_XTILEDATA) == 0;
+}
+#endif
+
+bool x64SupportsCpuid() {
     // Check if cpu supports the CPUID instruction by changing the id flag
     // in the FLAGS register and see if that worked
     bool supportsCpuid = false;
@@ -353,7 +1472,7 @@ bool getCpuidInfo(struct X64Info* cpuid) {
         // Get rflags into r8 and swap the id bit
         "pushfq             \n"
         "pop r8             \n"
-        "btc r8, $21        \n"
+        "btc r8, 21         \n"
         "push r8            \n"
         // Now check if the id flag change worked
         "popfq              \n"
@@ -365,9 +1484,127 @@ bool getCpuidInfo(struct X64Info* cpuid) {
         :
         : "r8", "r9"
     );
-    if (!supportsCpuid) {
+    return supportsCpuid;
+}
+
+bool getCpuidInfoFromBackend(const struct X64CpuidBackend* backend, struct X64Info* cpuid);
+
+// Highest hypervisor leaf given leaf 0x40000000 EAX. Some hypervisors leave EAX
+// at 0, which means 0x40000001 is implemented
+static uint32_t x64HypervisorMaxLeaf(uint32_t eax) {
+    return eax >= 0x40000000 ? eax : 0x40000001;
+}
+
+void x64DecodeHypervisor(const struct X64CpuidBackend* backend, struct X64Info* cpuid) {
+    static const struct { char vendor[CPUID_VENDOR_STRING_SIZE + 1]; enum X64Hypervisor hypervisor; } vendors[] = {
+        { "KVMKVMKVM\0\0\0",   X64_HYPERVISOR_KVM },
+        { "Microsoft Hv",       X64_HYPERVISOR_HYPERV },
+        { "VMwareVMware",       X64_HYPERVISOR_VMWARE },
+        { "XenVMMXenVMM",       X64_HYPERVISOR_XEN },
+        { "TCGTCGTCGTCG",       X64_HYPERVISOR_TCG },
+        { "VBoxVBoxVBox",       X64_HYPERVISOR_VIRTUALBOX },
+        { "ACRNACRNACRN",       X64_HYPERVISOR_ACRN },
+        { "bhyve bhyve ",       X64_HYPERVISOR_BHYVE },
+    };
+
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0x40000000, 0, &result);
+    cpuid->hypervisorMaxLeaf = x64HypervisorMaxLeaf(result.eax);
+    *(uint32_t*)cpuid->hypervisorVendor     = result.ebx;
+    *(uint32_t*)&cpuid->hypervisorVendor[4] = result.ecx;
+    *(uint32_t*)&cpuid->hypervisorVendor[8] = result.edx;
+
+    cpuid->hypervisor = X64_HYPERVISOR_UNKNOWN;
+    for (uint32_t i = 0; i < sizeof(vendors) / sizeof(vendors[0]); i++) {
+        if (memcmp(cpuid->hypervisorVendor, vendors[i].vendor, CPUID_VENDOR_STRING_SIZE) == 0) {
+            cpuid->hypervisor = vendors[i].hypervisor;
+            break;
+        }
+    }
+
+    if (cpuid->hypervisor == X64_HYPERVISOR_KVM) {
+        x64BackendCpuid(backend, 0x40000001, 0, &result);
+        cpuid->hypervisorFeatures = result.eax;
+        cpuid->hypervisorHints = result.edx;
+    } else if (cpuid->hypervisor == X64_HYPERVISOR_HYPERV && cpuid->hypervisorMaxLeaf >= 0x40000004) {
+        x64BackendCpuid(backend, 0x40000003, 0, &result);
+        cpuid->hypervisorFeatures = result.eax;
+        x64BackendCpuid(backend, 0x40000004, 0, &result);
+        cpuid->hypervisorHints = result.eax;
+        cpuid->hypervisorSpinRetries = result.ebx;
+    }
+
+    if (cpuid->hypervisorMaxLeaf >= 0x40000010 && cpuid->hypervisorMaxLeaf < 0x40000100) {
+        x64BackendCpuid(backend, 0x40000010, 0, &result);
+        cpuid->hypervisorTscKhz = result.eax;
+    }
+}
+
+const char* x64HypervisorName(enum X64Hypervisor hypervisor) {
+    switch (hypervisor) {
+    case X64_HYPERVISOR_NONE:       return "none";
+    case X64_HYPERVISOR_KVM:        return "KVM";
+    case X64_HYPERVISOR_HYPERV:     return "Hyper-V";
+    case X64_HYPERVISOR_VMWARE:     return "VMware";
+    case X64_HYPERVISOR_XEN:        return "Xen";
+    case X64_HYPERVISOR_TCG:        return "QEMU TCG";
+    case X64_HYPERVISOR_VIRTUALBOX: return "VirtualBox";
+    case X64_HYPERVISOR_ACRN:       return "ACRN";
+    case X64_HYPERVISOR_BHYVE:      return "bhyve";
+    default:                        return "unknown";
+    }
+}
+
+// How a waiter should spin on a contended lock or flag
+struct X64SpinStrategy {
+    // PAUSE iterations before giving up the CPU, UINT32_MAX to never yield
+    uint32_t    spinIterations;
+    // Give up the CPU through the hypervisor's directed yield when available
+    bool        paravirtYield;
+};
+
+// On bare metal, and on vCPUs the hypervisor reports as dedicated, busy
+// spinning is cheapest. Elsewhere the lock holder may be a preempted vCPU, so
+// spinning only burns the time slice it needs to run, and a short spin before
+// yielding wins
+void x64GetSpinStrategy(const struct X64Info* cpuid, struct X64SpinStrategy* strategy) {
+    strategy->spinIterations = UINT32_MAX;
+    strategy->paravirtYield = false;
+
+    switch (cpuid->hypervisor) {
+    case X64_HYPERVISOR_NONE:
+        return;
+    case X64_HYPERVISOR_KVM:
+        if (cpuid->hypervisorHints & X64_KVM_HINT_REALTIME) {
+            return;
+        }
+        strategy->paravirtYield = (cpuid->hypervisorFeatures & X64_KVM_FEATURE_PV_SCHED_YIELD) != 0;
+        break;
+    case X64_HYPERVISOR_HYPERV:
+        if (cpuid->hypervisorSpinRetries == X64_HYPERV_SPIN_NEVER_NOTIFY) {
+            return;
+        }
+        if (cpuid->hypervisorSpinRetries != 0) {
+            strategy->spinIterations = cpuid->hypervisorSpinRetries;
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    strategy->spinIterations = 1024;
+}
+
+bool getCpuidInfo(struct X64Info* cpuid) {
+    if (!x64SupportsCpuid()) {
         return false;
     }
+    return getCpuidInfoFromBackend(&x64NativeBackend, cpuid);
+}
+
+// Decodes all supported leaves read through backend
+bool getCpuidInfoFromBackend(const struct X64CpuidBackend* backend, struct X64Info* cpuid) {
+    *cpuid = (struct X64Info){};
 
     // -------------------------------------------------
     //                      Leaf 0
@@ -376,7 +1613,7 @@ bool getCpuidInfo(struct X64Info* cpuid) {
     { 
         const uint32_t leaf = 0;
         struct X64CpuidResult result = {};
-        executeCpuidWithLeaf(leaf, &result);
+        x64BackendCpuid(backend, leaf, 0, &result);
 
         cpuid->maxInputBasicInfo = result.eax;
 
@@ -393,7 +1630,7 @@ bool getCpuidInfo(struct X64Info* cpuid) {
     { 
         const uint32_t leaf = 1;
         struct X64CpuidResult result = {};
-        executeCpuidWithLeaf(leaf, &result);
+        x64BackendCpuid(backend, leaf, 0, &result);
 
         cpuid->steppingId         = x64EaxGetStepping(result.eax);
         cpuid->modelId            = x64EaxGetModel(result.eax);
@@ -411,6 +1648,12 @@ bool getCpuidInfo(struct X64Info* cpuid) {
         cpuid->feature1 = result.ecx;
         cpuid->feature2 = result.edx;
 
+        cpuid->xcr0 = 0;
+        if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_OSXSAVE) {
+            struct X64CpuidResult xcr0 = {};
+            x64BackendCpuid(backend, X64_PSEUDO_LEAF_XCR0, 0, &xcr0);
+            cpuid->xcr0 = ((uint64_t)xcr0.edx << 32) | xcr0.eax;
+        }
     }
 
     // -------------------------------------------------
@@ -420,12 +1663,13 @@ bool getCpuidInfo(struct X64Info* cpuid) {
     { 
         const uint32_t leaf = 2;
         struct X64CpuidResult result = {};
-        executeCpuidWithLeaf(leaf, &result);
+        x64BackendCpuid(backend, leaf, 0, &result);
 
 #define CPUID_HAS_DESCRIPTOR_FLAG (1 << 31)
 
         uint32_t* descriptorRegs = (uint32_t*)&result;
         uint8_t* descriptors = (uint8_t*)&result;
+        cpuid->leaf2DescriptorCount = 0;
         for (uint32_t reg = 0; reg < 4; reg++) {
             // Check if register contains valid info (bit 31 = 0) or is reserved (bit 31 = 1)
             if (descriptorRegs[reg] & CPUID_HAS_DESCRIPTOR_FLAG) {
@@ -443,15 +1687,124 @@ bool getCpuidInfo(struct X64Info* cpuid) {
                     continue;
                 }
 
-                char* descString = 0;
-                bool validDesc = x64TranslateLeaf2Descriptor(descriptor, &descString);
-                if (validDesc) {
-                    printf("\t%s\n", descString);
-                }
+                cpuid->leaf2Descriptors[cpuid->leaf2DescriptorCount++] = descriptor;
+            }
+        }
+    }
+
+    // -------------------------------------------------
+    //                      Leaf 4
+    // -------------------------------------------------
+
+    cpuid->cacheLeaf = 0;
+    cpuid->cacheCount = 0;
+    if (cpuid->maxInputBasicInfo >= 4) {
+        x64DecodeDeterministicCaches(backend, 4, cpuid);
+    }
+
+    // -------------------------------------------------
+    //                      Leaf 7
+    // -------------------------------------------------
+
+    if (cpuid->maxInputBasicInfo >= 7) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 7, 0, &result);
+
+        cpuid->maxStructuredSubleaf = result.eax;
+        cpuid->structuredFeature1 = result.ebx;
+        cpuid->structuredFeature2 = result.ecx;
+        cpuid->structuredFeature3 = result.edx;
+
+        if (cpuid->maxStructuredSubleaf >= 1) {
+            x64BackendCpuid(backend, 7, 1, &result);
+            cpuid->structuredFeature4 = result.eax;
+        }
+    }
+
+    // -------------------------------------------------
+    //                      Leaf 0xA
+    // -------------------------------------------------
+
+    if (cpuid->maxInputBasicInfo >= 0xA) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0xA, 0, &result);
+
+        cpuid->pmuVersion = result.eax & 0xFF;
+        cpuid->pmuCounters = (result.eax >> 8) & 0xFF;
+        cpuid->pmuCounterWidth = (result.eax >> 16) & 0xFF;
+        const uint32_t eventCount = result.eax >> 24;
+        cpuid->pmuEvents = ~result.ebx & (eventCount >= 32 ? 0xFFFFFFFF : (1u << eventCount) - 1);
+        if (cpuid->pmuVersion >= 2) {
+            cpuid->pmuFixedCounters = result.edx & 0b11111;
+            cpuid->pmuFixedCounterWidth = (result.edx >> 5) & 0xFF;
+            cpuid->pmuFixedCounterMask = (1u << cpuid->pmuFixedCounters) - 1;
+        }
+        if (cpuid->pmuVersion >= 5) {
+            cpuid->pmuFixedCounterMask |= result.ecx;
+        }
+    }
+
+    // -------------------------------------------------
+    //                      Leaf 0xD
+    // -------------------------------------------------
+
+    if (cpuid->maxInputBasicInfo >= 0xD && (cpuid->feature1 & X64_FEATURE_FLAG_ECX_XSAVE)) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0xD, 0, &result);
+
+        cpuid->xsaveSupportedComponents = ((uint64_t)result.edx << 32) | result.eax;
+        cpuid->xsaveEnabledSize = result.ebx;
+        cpuid->xsaveMaxSize = result.ecx;
+
+        x64BackendCpuid(backend, 0xD, 1, &result);
+        cpuid->xsaveFeatures = result.eax;
+        cpuid->xsaveCompactedSize = result.ebx;
+        cpuid->xsaveSupervisorComponents = ((uint64_t)result.edx << 32) | result.ecx;
+
+        cpuid->xsaveComponents[0] = (struct X64XsaveComponent){ 160, 0 };
+        cpuid->xsaveComponents[1] = (struct X64XsaveComponent){ 256, 160 };
+        const uint64_t components = cpuid->xsaveSupportedComponents | cpuid->xsaveSupervisorComponents;
+        for (uint32_t i = 2; i < X64_MAX_XSAVE_COMPONENTS; i++) {
+            if (!(components & (1ull << i))) {
+                continue;
             }
+            x64BackendCpuid(backend, 0xD, i, &result);
+            struct X64XsaveComponent* component = &cpuid->xsaveComponents[i];
+            component->size = result.eax;
+            component->offset = result.ebx;
+            component->supervisor = result.ecx & 1;
+            component->aligned = (result.ecx >> 1) & 1;
         }
-        printf("\n");
+    }
 
+    // -------------------------------------------------
+    //                      Leaf 0x15, 0x16
+    // -------------------------------------------------
+
+    if (cpuid->maxInputBasicInfo >= 0x15) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x15, 0, &result);
+
+        cpuid->tscDenominator = result.eax;
+        cpuid->tscNumerator = result.ebx;
+        cpuid->crystalHz = result.ecx;
+    }
+
+    if (cpuid->maxInputBasicInfo >= 0x16) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x16, 0, &result);
+
+        cpuid->baseMhz = result.eax & 0xFFFF;
+        cpuid->maxMhz = result.ebx & 0xFFFF;
+        cpuid->busMhz = result.ecx & 0xFFFF;
+    }
+
+    // -------------------------------------------------
+    //                      Hypervisor
+    // -------------------------------------------------
+
+    if (cpuid->feature1 & X64_FEATURE_FLAG_ECX_HYPERVISOR) {
+        x64DecodeHypervisor(backend, cpuid);
     }
 
     // -------------------------------------------------
@@ -461,19 +1814,27 @@ bool getCpuidInfo(struct X64Info* cpuid) {
     {
         const uint32_t leaf = 0x80000000;
         struct X64CpuidResult result = {};
-        executeCpuidWithLeaf(leaf, &result);
+        x64BackendCpuid(backend, leaf, 0, &result);
 
         cpuid->hasExtendedInfo = result.eax & leaf;
         cpuid->maxExtendedLeaf = result.eax;
     }
 
+    if (cpuid->hasExtendedInfo && cpuid->maxExtendedLeaf >= 0x80000001) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x80000001, 0, &result);
+
+        cpuid->extendedFeature1 = result.ecx;
+        cpuid->extendedFeature2 = result.edx;
+    }
+
     {
         uint32_t startLeaf = 0x80000002;
         if (cpuid->hasExtendedInfo && cpuid->maxExtendedLeaf >= 0x80000004) {
             char* brandStringCursor = cpuid->brandString;
             for (uint32_t i = 0; i < 3; i++) {
                 struct X64CpuidResult result2 = {};
-                executeCpuidWithLeaf(startLeaf + i, &result2);
+                x64BackendCpuid(backend, startLeaf + i, 0, &result2);
 
                 *(uint32_t*)brandStringCursor = result2.eax;
                 *(uint32_t*)&brandStringCursor[4] = result2.ebx;
@@ -485,5 +1846,166 @@ bool getCpuidInfo(struct X64Info* cpuid) {
         }
     }
 
+    if (cpuid->hasExtendedInfo && cpuid->maxExtendedLeaf >= 0x80000007) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x80000007, 0, &result);
+        cpuid->powerFeatures = result.edx;
+    }
+
+    if (cpuid->hasExtendedInfo && cpuid->maxExtendedLeaf >= 0x80000008) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x80000008, 0, &result);
+        // Intel leaves ECX reserved
+        cpuid->packageThreads = result.ecx ? (result.ecx & 0xFF) + 1 : 0;
+        cpuid->apicIdCoreIdSize = (result.ecx >> 12) & 0xF;
+    }
+
+    if (cpuid->maxExtendedLeaf >= 0x8000001E && cpuid->maxExtendedLeaf < 0x80000100
+        && (cpuid->extendedFeature1 & X64_EXTENDED_FEATURE_FLAG_ECX_TOPOEXT)) {
+        struct X64CpuidResult result = {};
+        x64BackendCpuid(backend, 0x8000001E, 0, &result);
+        cpuid->extendedApicId = result.eax;
+        cpuid->computeUnitId = result.ebx & 0xFF;
+        cpuid->threadsPerComputeUnit = ((result.ebx >> 8) & 0xFF) + 1;
+        cpuid->nodeId = result.ecx & 0xFF;
+        cpuid->nodesPerPackage = ((result.ecx >> 8) & 0x7) + 1;
+    }
+
+    // Leaf 0x18 replaces the leaf 2 TLB descriptors, AMD reports TLBs in the extended range
+    if (cpuid->maxInputBasicInfo >= 0x18) {
+        x64DecodeTlbLeaf(backend, cpuid);
+    }
+    if (cpuid->tlbCount == 0) {
+        x64DecodeLeaf2Tlbs(cpuid);
+    }
+    if (cpuid->tlbCount == 0 && cpuid->maxExtendedLeaf >= 0x80000005 && cpuid->maxExtendedLeaf < 0x80000100) {
+        x64DecodeAmdTlbs(backend, cpuid);
+    }
+
+    // AMD does not implement leaf 4 but reports the same layout in 0x8000001D
+    if (cpuid->cacheCount == 0 && cpuid->maxExtendedLeaf >= 0x8000001D
+        && (cpuid->extendedFeature1 & X64_EXTENDED_FEATURE_FLAG_ECX_TOPOEXT)) {
+        x64DecodeDeterministicCaches(backend, 0x8000001D, cpuid);
+    }
+
+    cpuid->usableFeatures = x64ComputeUsableFeatures(cpuid);
+    x64BuildFeatureSet(cpuid, &cpuid->features);
+
     return true;
 }
+
+// Returns the data or unified cache of the given level, or 0 if there is none
+const struct X64CacheInfo* x64FindDataCache(const struct X64Info* cpuid, uint8_t level) {
+    for (uint32_t i = 0; i < cpuid->cacheCount; i++) {
+        const struct X64CacheInfo* cache = &cpuid->caches[i];
+        if (cache->level == level && cache->type != X64_CACHE_TYPE_INSTRUCTION) {
+            return cache;
+        }
+    }
+    return 0;
+}
+
+static uint64_t x64TlbPageBytes(uint8_t pageSize) {
+    switch (pageSize) {
+    case X64_TLB_PAGE_2M:   return 2ull << 20;
+    case X64_TLB_PAGE_4M:   return 4ull << 20;
+    case X64_TLB_PAGE_1G:   return 1ull << 30;
+    default:                return 4ull << 10;
+    }
+}
+
+// Bytes of data the TLBs of one level map with pages of the given size, 0 if
+// no data TLB at that level holds those pages. Where a level has several data
+// arrays (e.g. separate load and store TLBs) the largest one counts
+uint64_t x64GetTlbReach(const struct X64Info* cpuid, uint8_t level, uint8_t pageSize) {
+    uint32_t entries = 0;
+    for (uint32_t i = 0; i < cpuid->tlbCount; i++) {
+        const struct X64TlbInfo* tlb = &cpuid->tlbs[i];
+        if (tlb->level != level || tlb->type == X64_TLB_TYPE_INSTRUCTION || !(tlb->pageSizes & pageSize)) {
+            continue;
+        }
+        if (tlb->entries > entries) {
+            entries = tlb->entries;
+        }
+    }
+    return entries * x64TlbPageBytes(pageSize);
+}
+
+// Smallest page size (X64_TLB_PAGE_4K, _2M or _1G) whose TLB reach covers
+// workingSetBytes, checked from the first TLB level outwards. When nothing
+// covers it the largest page size the CPU supports is returned
+uint8_t x64AdvisePageSize(const struct X64Info* cpuid, uint64_t workingSetBytes) {
+    const bool has1G = x64FeatureSetHas(&cpuid->features, X64_FEATURE_PDPE1GB);
+    uint8_t maxLevel = 0;
+    for (uint32_t i = 0; i < cpuid->tlbCount; i++) {
+        if (cpuid->tlbs[i].level > maxLevel) {
+            maxLevel = cpuid->tlbs[i].level;
+        }
+    }
+
+    for (uint8_t level = 1; level <= maxLevel; level++) {
+        if (x64GetTlbReach(cpuid, level, X64_TLB_PAGE_4K) >= workingSetBytes) {
+            return X64_TLB_PAGE_4K;
+        }
+    }
+    for (uint8_t level = 1; level <= maxLevel; level++) {
+        if (x64GetTlbReach(cpuid, level, X64_TLB_PAGE_2M) >= workingSetBytes) {
+            return X64_TLB_PAGE_2M;
+        }
+    }
+    return has1G ? X64_TLB_PAGE_1G : X64_TLB_PAGE_2M;
+}
+
+// -------------------------------------------------
+//                  Cached snapshot
+// -------------------------------------------------
+
+enum X64CacheState {
+    X64_CACHE_STATE_UNINITIALIZED   = 0,
+    X64_CACHE_STATE_INITIALIZING    = 1,
+    X64_CACHE_STATE_READY           = 2,
+};
+
+static struct X64Info   x64CachedInfo;
+static bool             x64CachedHasCpuid;
+static uint32_t         x64CacheState = X64_CACHE_STATE_UNINITIALIZED;
+
+// Runs getCpuidInfo() exactly once for the whole process. Concurrent callers
+// spin until the thread that won the race has published the snapshot.
+// Returns false if the CPU does not support CPUID
+bool x64InitCpuidCache() {
+    uint32_t state = __atomic_load_n(&x64CacheState, __ATOMIC_ACQUIRE);
+    if (state == X64_CACHE_STATE_READY) {
+        return x64CachedHasCpuid;
+    }
+
+    uint32_t expected = X64_CACHE_STATE_UNINITIALIZED;
+    if (__atomic_compare_exchange_n(&x64CacheState, &expected, X64_CACHE_STATE_INITIALIZING,
+                                    false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        x64CachedHasCpuid = getCpuidInfo(&x64CachedInfo);
+        __atomic_store_n(&x64CacheState, X64_CACHE_STATE_READY, __ATOMIC_RELEASE);
+        return x64CachedHasCpuid;
+    }
+
+    while (__atomic_load_n(&x64CacheState, __ATOMIC_ACQUIRE) != X64_CACHE_STATE_READY) {
+        __builtin_ia32_pause();
+    }
+    return x64CachedHasCpuid;
+}
+
+// Returns the process wide snapshot, initializing it on first use. After the
+// first call this is a single predictable branch and no CPUID is executed.
+// The snapshot is zeroed if the CPU does not support CPUID
+static inline const struct X64Info* x64Cpu() {
+    if (__builtin_expect(__atomic_load_n(&x64CacheState, __ATOMIC_ACQUIRE) != X64_CACHE_STATE_READY, 0)) {
+        x64InitCpuidCache();
+    }
+    return &x64CachedInfo;
+}
+
+#define x64CpuHasFeature1(flag)     ((x64Cpu()->feature1 & (flag)) != 0)
+#define x64CpuHasFeature2(flag)     ((x64Cpu()->feature2 & (flag)) != 0)
+#define x64CpuHasStructuredFeature1(flag)   ((x64Cpu()->structuredFeature1 & (flag)) != 0)
+#define x64CpuHasStructuredFeature2(flag)   ((x64Cpu()->structuredFeature2 & (flag)) != 0)
+#define x64CpuHasStructuredFeature3(flag)   ((x64Cpu()->structuredFeature3 & (flag)) != 0)
+#define x64CpuCanUse(flags)                 ((x64Cpu()->usableFeatures & (flags)) == (flags))
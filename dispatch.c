@@ -0,0 +1,128 @@
+// Runtime ISA dispatch.
+//
+// A kernel is registered as a list of variants, each tagged with the ISA level
+// it was compiled for. x64DispatchRegister() picks the highest level the CPU
+// and OS support from the cached X64Info snapshot and returns that variant's
+// function pointer, so the choice is made once and calls afterwards are a
+// plain indirect call.
+//
+// Requires cpuid.c to be included first.
+
+enum X64IsaLevel {
+    X64_ISA_SCALAR  = 0,
+    // SSE4.2, SSSE3, POPCNT
+    X64_ISA_SSE42   = 1,
+    // AVX, AVX2, FMA, BMI1, BMI2, F16C with YMM state enabled
+    X64_ISA_AVX2    = 2,
+    // AVX-512 F/CD/BW/DQ/VL with opmask and ZMM state enabled
+    X64_ISA_AVX512  = 3,
+    X64_ISA_COUNT,
+};
+
+#define X64_MAX_DISPATCHERS     64
+
+typedef void (*X64DispatchFn)(void);
+
+struct X64DispatchVariant {
+    enum X64IsaLevel    level;
+    const char*         name;
+    X64DispatchFn       fn;
+};
+
+struct X64Dispatcher {
+    const char*                         name;
+    const struct X64DispatchVariant*    variants;
+    uint32_t                            variantCount;
+    const struct X64DispatchVariant*    selected;
+};
+
+static struct X64Dispatcher    x64Dispatchers[X64_MAX_DISPATCHERS];
+static uint32_t                x64DispatcherCount;
+
+const char* x64IsaLevelName(enum X64IsaLevel level) {
+    switch (level) {
+    case X64_ISA_SCALAR:    return "scalar";
+    case X64_ISA_SSE42:     return "SSE4.2";
+    case X64_ISA_AVX2:      return "AVX2";
+    case X64_ISA_AVX512:    return "AVX-512";
+    default:                return "unknown";
+    }
+}
+
+// Levels are gated on the OS-aware usable tier, so a level is only reported
+// when its register state is enabled in XCR0
+bool x64IsaLevelSupported(const struct X64Info* cpuid, enum X64IsaLevel level) {
+    const uint32_t sse42 = X64_USABLE_SSSE3 | X64_USABLE_SSE4_1 | X64_USABLE_SSE4_2;
+    const uint32_t avx2 = X64_USABLE_AVX | X64_USABLE_AVX2 | X64_USABLE_FMA | X64_USABLE_F16C;
+    const uint32_t avx512 = X64_USABLE_AVX512F | X64_USABLE_AVX512CD | X64_USABLE_AVX512BW
+                          | X64_USABLE_AVX512DQ | X64_USABLE_AVX512VL;
+    const uint32_t bmi = X64_STRUCTURED_FEATURE_FLAG_EBX_BMI1 | X64_STRUCTURED_FEATURE_FLAG_EBX_BMI2;
+
+    switch (level) {
+    case X64_ISA_SCALAR:
+        return true;
+    case X64_ISA_SSE42:
+        return (cpuid->usableFeatures & sse42) == sse42
+            && (cpuid->feature1 & X64_FEATURE_FLAG_ECX_POPCNT);
+    case X64_ISA_AVX2:
+        return x64IsaLevelSupported(cpuid, X64_ISA_SSE42)
+            && (cpuid->usableFeatures & avx2) == avx2
+            && (cpuid->structuredFeature1 & bmi) == bmi;
+    case X64_ISA_AVX512:
+        return x64IsaLevelSupported(cpuid, X64_ISA_AVX2)
+            && (cpuid->usableFeatures & avx512) == avx512;
+    default:
+        return false;
+    }
+}
+
+// Highest ISA level usable on this CPU
+enum X64IsaLevel x64GetIsaLevel(const struct X64Info* cpuid) {
+    enum X64IsaLevel level = X64_ISA_SCALAR;
+    while (level + 1 < X64_ISA_COUNT && x64IsaLevelSupported(cpuid, level + 1)) {
+        level++;
+    }
+    return level;
+}
+
+// Returns the variant with the highest level that does not exceed maxLevel,
+// or 0 if no variant qualifies
+const struct X64DispatchVariant* x64SelectVariant(const struct X64DispatchVariant* variants,
+                                                  uint32_t variantCount, enum X64IsaLevel maxLevel) {
+    const struct X64DispatchVariant* selected = 0;
+    for (uint32_t i = 0; i < variantCount; i++) {
+        if (variants[i].level > maxLevel) {
+            continue;
+        }
+        if (!selected || variants[i].level > selected->level) {
+            selected = &variants[i];
+        }
+    }
+    return selected;
+}
+
+// Resolves a kernel for the running CPU and records the choice so it can be
+// listed with x64GetDispatchers(). Meant to be called from single threaded
+// initialization code. Returns 0 if no variant is usable
+X64DispatchFn x64DispatchRegister(const char* name, const struct X64DispatchVariant* variants,
+                                  uint32_t variantCount) {
+    const struct X64DispatchVariant* selected =
+        x64SelectVariant(variants, variantCount, x64GetIsaLevel(x64Cpu()));
+    if (!selected) {
+        return 0;
+    }
+
+    if (x64DispatcherCount < X64_MAX_DISPATCHERS) {
+        struct X64Dispatcher* dispatcher = &x64Dispatchers[x64DispatcherCount++];
+        dispatcher->name = name;
+        dispatcher->variants = variants;
+        dispatcher->variantCount = variantCount;
+        dispatcher->selected = selected;
+    }
+    return selected->fn;
+}
+
+const struct X64Dispatcher* x64GetDispatchers(uint32_t* count) {
+    *count = x64DispatcherCount;
+    return x64Dispatchers;
+}
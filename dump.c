@@ -0,0 +1,324 @@
+// Binary raw leaf captures and the backend that replays them.
+//
+// A capture records every (leaf, subleaf) -> EAX/EBX/ECX/EDX tuple of a host
+// so the decoder can run offline against it. File layout, little endian:
+//
+//   struct X64DumpHeader                   magic "X64CPUID", version, entry count
+//   struct X64DumpEntry[entryCount]        sorted by (leaf, subleaf), no duplicates
+//
+// Replaying maps the file read-only and binary searches the entries, so opening
+// a capture costs one mmap regardless of its size.
+//
+// Captures can also be written out as a stand-in /dev/cpu tree, one
+// <root>/<cpu>/cpuid file per CPU, for the cpuid device backend in topology.c.
+//
+// Requires cpuid.c to be included first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__unix__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define X64_DUMP_MAGIC      "X64CPUID"
+#define X64_DUMP_VERSION    1
+
+struct X64DumpHeader {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    entryCount;
+};
+
+struct X64DumpEntry {
+    uint32_t                leaf;
+    uint32_t                subleaf;
+    struct X64CpuidResult   regs;
+};
+
+static int x64CompareDumpEntries(const void* a, const void* b) {
+    const struct X64DumpEntry* x = a;
+    const struct X64DumpEntry* y = b;
+    if (x->leaf != y->leaf) {
+        return x->leaf < y->leaf ? -1 : 1;
+    }
+    return (x->subleaf > y->subleaf) - (x->subleaf < y->subleaf);
+}
+
+// -------------------------------------------------
+//                      Recording
+// -------------------------------------------------
+
+// Backend wrapper that forwards every query to source and keeps the results
+struct X64CpuidRecorder {
+    const struct X64CpuidBackend*   source;
+    struct X64DumpEntry*            entries;
+    uint32_t                        entryCount;
+    uint32_t                        capacity;
+    bool                            outOfMemory;
+};
+
+static void x64RecorderQuery(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
+    struct X64CpuidRecorder* recorder = ctx;
+    x64BackendCpuid(recorder->source, leaf, subleaf, result);
+
+    if (recorder->entryCount == recorder->capacity) {
+        uint32_t capacity = recorder->capacity ? recorder->capacity * 2 : 256;
+        struct X64DumpEntry* entries = realloc(recorder->entries, capacity * sizeof(struct X64DumpEntry));
+        if (!entries) {
+            recorder->outOfMemory = true;
+            return;
+        }
+        recorder->entries = entries;
+        recorder->capacity = capacity;
+    }
+
+    struct X64DumpEntry* entry = &recorder->entries[recorder->entryCount++];
+    entry->leaf = leaf;
+    entry->subleaf = subleaf;
+    entry->regs = *result;
+}
+
+// Initializes recorder and a backend that records through it
+void x64InitRecorder(struct X64CpuidRecorder* recorder, const struct X64CpuidBackend* source,
+                     struct X64CpuidBackend* recordingBackend) {
+    *recorder = (struct X64CpuidRecorder){};
+    recorder->source = source;
+    recordingBackend->query = x64RecorderQuery;
+    recordingBackend->ctx = recorder;
+}
+
+void x64FreeRecorder(struct X64CpuidRecorder* recorder) {
+    free(recorder->entries);
+    *recorder = (struct X64CpuidRecorder){};
+}
+
+// Sorts the recorded entries and drops repeated queries of the same subleaf
+static void x64CompactRecorder(struct X64CpuidRecorder* recorder) {
+    qsort(recorder->entries, recorder->entryCount, sizeof(struct X64DumpEntry), x64CompareDumpEntries);
+
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < recorder->entryCount; i++) {
+        if (unique > 0 && x64CompareDumpEntries(&recorder->entries[unique - 1], &recorder->entries[i]) == 0) {
+            continue;
+        }
+        recorder->entries[unique++] = recorder->entries[i];
+    }
+    recorder->entryCount = unique;
+}
+
+static void x64RecordLeafRange(const struct X64CpuidBackend* backend, uint32_t firstLeaf, uint32_t lastLeaf) {
+    for (uint32_t leaf = firstLeaf; leaf <= lastLeaf; leaf++) {
+        uint32_t subleafCount = x64GetSubleafCount(backend, leaf);
+        for (uint32_t subleaf = 0; subleaf < subleafCount; subleaf++) {
+            struct X64CpuidResult result;
+            x64BackendCpuid(backend, leaf, subleaf, &result);
+        }
+    }
+}
+
+// Sweeps every basic, hypervisor and extended leaf with all of its subleaves,
+// plus XCR0, into the recorder. Returns false if memory ran out
+bool x64RecordAllLeaves(struct X64CpuidRecorder* recorder) {
+    struct X64CpuidBackend backend = { x64RecorderQuery, recorder };
+    struct X64CpuidResult result = {};
+
+    x64BackendCpuid(&backend, 0, 0, &result);
+    x64RecordLeafRange(&backend, 0, result.eax);
+
+    x64BackendCpuid(&backend, 1, 0, &result);
+    const uint32_t feature1 = result.ecx;
+    if (feature1 & X64_FEATURE_FLAG_ECX_OSXSAVE) {
+        x64BackendCpuid(&backend, X64_PSEUDO_LEAF_XCR0, 0, &result);
+    }
+    if (feature1 & X64_FEATURE_FLAG_ECX_HYPERVISOR) {
+        // The same range x64DecodeHypervisor() reads
+        x64BackendCpuid(&backend, 0x40000000, 0, &result);
+        const uint32_t maxLeaf = x64HypervisorMaxLeaf(result.eax);
+        if (maxLeaf < 0x40000100) {
+            x64RecordLeafRange(&backend, 0x40000001, maxLeaf);
+        }
+    }
+
+    x64BackendCpuid(&backend, 0x80000000, 0, &result);
+    if ((result.eax & 0x80000000) && result.eax < 0x80000100) {
+        x64RecordLeafRange(&backend, 0x80000000, result.eax);
+    }
+
+    return !recorder->outOfMemory;
+}
+
+bool x64WriteCpuidDump(struct X64CpuidRecorder* recorder, const char* path) {
+    if (recorder->outOfMemory) {
+        return false;
+    }
+    x64CompactRecorder(recorder);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    struct X64DumpHeader header = {};
+    memcpy(header.magic, X64_DUMP_MAGIC, sizeof(header.magic));
+    header.version = X64_DUMP_VERSION;
+    header.entryCount = recorder->entryCount;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(recorder->entries, sizeof(struct X64DumpEntry), recorder->entryCount, file) == recorder->entryCount;
+    return fclose(file) == 0 && ok;
+}
+
+#if defined(__unix__)
+
+// Writes entries as <root>/<osCpuId>/cpuid in the X64_CPUID_TREE_STRIDE layout,
+// XCR0 included at the offset of its pseudo leaf
+bool x64WriteCpuidTree(const struct X64DumpEntry* entries, uint32_t entryCount, const char* root, uint32_t osCpuId) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%u", root, osCpuId);
+    if ((mkdir(root, 0755) != 0 && errno != EEXIST) || (mkdir(path, 0755) != 0 && errno != EEXIST)) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/%u/cpuid", root, osCpuId);
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < entryCount; i++) {
+        const struct X64DumpEntry* entry = &entries[i];
+        const uint64_t offset = ((uint64_t)entry->subleaf << 32 | entry->leaf) * X64_CPUID_TREE_STRIDE;
+        ok = pwrite(fd, &entry->regs, sizeof(entry->regs), (off_t)offset) == sizeof(entry->regs);
+    }
+    return close(fd) == 0 && ok;
+}
+
+#else
+
+bool x64WriteCpuidTree(const struct X64DumpEntry* entries, uint32_t entryCount, const char* root, uint32_t osCpuId) {
+    return false;
+}
+
+#endif
+
+// -------------------------------------------------
+//                      Replay
+// -------------------------------------------------
+
+struct X64CpuidDump {
+    const void*                 data;
+    size_t                      size;
+    const struct X64DumpEntry*  entries;
+    uint32_t                    entryCount;
+    // data was mmapped (or malloced) by x64OpenCpuidDump and must be released
+    bool                        mapped;
+};
+
+// Validates a capture that is already in memory. The dump keeps pointing
+// into data, which must outlive it
+bool x64OpenCpuidDumpMemory(const void* data, size_t size, struct X64CpuidDump* dump) {
+    *dump = (struct X64CpuidDump){};
+    if (size < sizeof(struct X64DumpHeader)) {
+        return false;
+    }
+
+    const struct X64DumpHeader* header = data;
+    if (memcmp(header->magic, X64_DUMP_MAGIC, sizeof(header->magic)) != 0
+        || header->version != X64_DUMP_VERSION
+        || (size - sizeof(struct X64DumpHeader)) / sizeof(struct X64DumpEntry) < header->entryCount) {
+        return false;
+    }
+
+    dump->data = data;
+    dump->size = size;
+    dump->entries = (const struct X64DumpEntry*)(header + 1);
+    dump->entryCount = header->entryCount;
+    return true;
+}
+
+bool x64OpenCpuidDump(const char* path, struct X64CpuidDump* dump) {
+    *dump = (struct X64CpuidDump){};
+#if defined(__unix__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    if (!x64OpenCpuidDumpMemory(data, st.st_size, dump)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void* data = size > 0 ? malloc(size) : 0;
+    bool read = data && fread(data, size, 1, file) == 1;
+    fclose(file);
+
+    if (!read || !x64OpenCpuidDumpMemory(data, size, dump)) {
+        free(data);
+        return false;
+    }
+#endif
+    dump->mapped = true;
+    return true;
+}
+
+void x64CloseCpuidDump(struct X64CpuidDump* dump) {
+    if (dump->mapped) {
+#if defined(__unix__)
+        munmap((void*)dump->data, dump->size);
+#else
+        free((void*)dump->data);
+#endif
+    }
+    *dump = (struct X64CpuidDump){};
+}
+
+// Leaves that were not captured read as all zeroes
+static void x64DumpQuery(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
+    const struct X64CpuidDump* dump = ctx;
+    const struct X64DumpEntry key = { leaf, subleaf };
+
+    uint32_t low = 0;
+    uint32_t high = dump->entryCount;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int order = x64CompareDumpEntries(&dump->entries[mid], &key);
+        if (order == 0) {
+            *result = dump->entries[mid].regs;
+            return;
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *result = (struct X64CpuidResult){};
+}
+
+void x64DumpBackend(const struct X64CpuidDump* dump, struct X64CpuidBackend* backend) {
+    backend->query = x64DumpQuery;
+    backend->ctx = (void*)dump;
+}
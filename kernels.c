@@ -0,0 +1,225 @@
+// Reference kernels for the ISA dispatcher: CRC32C, memchr and a float dot
+// product. Each variant is compiled for its ISA with a target attribute so the
+// whole file builds without any -m flags.
+//
+// Call x64InitKernels() once at startup, then use x64Crc32c, x64Memchr and
+// x64DotProduct.
+//
+// Requires cpuid.c and dispatch.c to be included first.
+
+#include <stddef.h>
+#include <immintrin.h>
+
+#define X64_CRC32C_POLYNOMIAL   0x82F63B78
+
+typedef uint32_t    (*X64Crc32cFn)(uint32_t crc, const void* data, size_t size);
+typedef const void* (*X64MemchrFn)(const void* data, int c, size_t size);
+typedef float       (*X64DotProductFn)(const float* a, const float* b, size_t count);
+
+// Resolved by x64InitKernels()
+X64Crc32cFn         x64Crc32c;
+X64MemchrFn         x64Memchr;
+X64DotProductFn     x64DotProduct;
+
+// -------------------------------------------------
+//                      CRC32C
+// -------------------------------------------------
+
+static uint32_t x64Crc32cTable[256];
+
+static void x64BuildCrc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (X64_CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+        }
+        x64Crc32cTable[i] = crc;
+    }
+}
+
+// crc is the result of a previous call, or 0 to start a new checksum
+uint32_t x64Crc32cScalar(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc >> 8) ^ x64Crc32cTable[(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t x64Crc32cSse42(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    uint64_t crc64 = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t chunk;
+        __builtin_memcpy(&chunk, &bytes[i], sizeof(chunk));
+        crc64 = _mm_crc32_u64(crc64, chunk);
+    }
+
+    uint32_t crc32 = (uint32_t)crc64;
+    for (; i < size; i++) {
+        crc32 = _mm_crc32_u8(crc32, bytes[i]);
+    }
+    return ~crc32;
+}
+
+static const struct X64DispatchVariant x64Crc32cVariants[] = {
+    { X64_ISA_SCALAR,   "scalar",   (X64DispatchFn)x64Crc32cScalar },
+    { X64_ISA_SSE42,    "SSE4.2",   (X64DispatchFn)x64Crc32cSse42 },
+};
+
+// -------------------------------------------------
+//                      memchr
+// -------------------------------------------------
+
+const void* x64MemchrScalar(const void* data, int c, size_t size) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] == (uint8_t)c) {
+            return &bytes[i];
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("sse4.2")))
+const void* x64MemchrSse42(const void* data, int c, size_t size) {
+    const uint8_t* bytes = data;
+    const __m128i needle = _mm_set1_epi8((char)c);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)&bytes[i]);
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask) {
+            return &bytes[i + __builtin_ctz(mask)];
+        }
+    }
+    return x64MemchrScalar(&bytes[i], c, size - i);
+}
+
+__attribute__((target("avx2,bmi,bmi2")))
+const void* x64MemchrAvx2(const void* data, int c, size_t size) {
+    const uint8_t* bytes = data;
+    const __m256i needle = _mm256_set1_epi8((char)c);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)&bytes[i]);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask) {
+            return &bytes[i + _tzcnt_u32(mask)];
+        }
+    }
+    return x64MemchrScalar(&bytes[i], c, size - i);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl,bmi,bmi2")))
+const void* x64MemchrAvx512(const void* data, int c, size_t size) {
+    const uint8_t* bytes = data;
+    const __m512i needle = _mm512_set1_epi8((char)c);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m512i chunk = _mm512_loadu_si512((const void*)&bytes[i]);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, needle);
+        if (mask) {
+            return &bytes[i + _tzcnt_u64(mask)];
+        }
+    }
+
+    // Masked load so the tail never touches bytes past the end
+    if (i < size) {
+        __mmask64 valid = _bzhi_u64(~0ull, size - i);
+        __m512i chunk = _mm512_maskz_loadu_epi8(valid, &bytes[i]);
+        uint64_t mask = _mm512_mask_cmpeq_epi8_mask(valid, chunk, needle);
+        if (mask) {
+            return &bytes[i + _tzcnt_u64(mask)];
+        }
+    }
+    return 0;
+}
+
+static const struct X64DispatchVariant x64MemchrVariants[] = {
+    { X64_ISA_SCALAR,   "scalar",   (X64DispatchFn)x64MemchrScalar },
+    { X64_ISA_SSE42,    "SSE4.2",   (X64DispatchFn)x64MemchrSse42 },
+    { X64_ISA_AVX2,     "AVX2",     (X64DispatchFn)x64MemchrAvx2 },
+    { X64_ISA_AVX512,   "AVX-512",  (X64DispatchFn)x64MemchrAvx512 },
+};
+
+// -------------------------------------------------
+//                      Dot product
+// -------------------------------------------------
+
+float x64DotProductScalar(const float* a, const float* b, size_t count) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("sse4.2")))
+float x64DotProductSse42(const float* a, const float* b, size_t count) {
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]), _mm_loadu_ps(&b[i + 4])));
+    }
+
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum) + x64DotProductScalar(&a[i], &b[i], count - i);
+}
+
+__attribute__((target("avx2,fma")))
+float x64DotProductAvx2(const float* a, const float* b, size_t count) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i + 8]), _mm256_loadu_ps(&b[i + 8]), sum1);
+    }
+
+    __m256 sum256 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum256), _mm256_extractf128_ps(sum256, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum) + x64DotProductScalar(&a[i], &b[i], count - i);
+}
+
+__attribute__((target("avx512f")))
+float x64DotProductAvx512(const float* a, const float* b, size_t count) {
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&b[i]), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i + 16]), _mm512_loadu_ps(&b[i + 16]), sum1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1))
+         + x64DotProductScalar(&a[i], &b[i], count - i);
+}
+
+static const struct X64DispatchVariant x64DotProductVariants[] = {
+    { X64_ISA_SCALAR,   "scalar",   (X64DispatchFn)x64DotProductScalar },
+    { X64_ISA_SSE42,    "SSE4.2",   (X64DispatchFn)x64DotProductSse42 },
+    { X64_ISA_AVX2,     "AVX2",     (X64DispatchFn)x64DotProductAvx2 },
+    { X64_ISA_AVX512,   "AVX-512",  (X64DispatchFn)x64DotProductAvx512 },
+};
+
+#define X64_ARRAY_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+void x64InitKernels() {
+    x64BuildCrc32cTable();
+
+    x64Crc32c = (X64Crc32cFn)x64DispatchRegister("crc32c", x64Crc32cVariants,
+                                                 X64_ARRAY_COUNT(x64Crc32cVariants));
+    x64Memchr = (X64MemchrFn)x64DispatchRegister("memchr", x64MemchrVariants,
+                                                 X64_ARRAY_COUNT(x64MemchrVariants));
+    x64DotProduct = (X64DotProductFn)x64DispatchRegister("dot_product", x64DotProductVariants,
+                                                         X64_ARRAY_COUNT(x64DotProductVariants));
+}
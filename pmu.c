@@ -0,0 +1,206 @@
+// In-process performance counters.
+//
+// Opens instructions, core cycles and LLC misses for the calling thread with
+// perf_event_open, as one group so they are always scheduled together, and
+// maps the control page of each event. While the kernel grants user space
+// RDPMC (cap_user_rdpmc) a read is one RDPMC per counter under the page's
+// seqlock, with no system call. Otherwise, or while an event is not on a
+// counter, it falls back to read().
+//
+// Leaf 0xA tells ahead of time which of the events the PMU implements and
+// whether they fit at once: instructions and cycles use fixed counters 0 and
+// 1, LLC misses take a general purpose counter. Without leaf 0xA (AMD, or a
+// VM without a virtual PMU) the events are simply tried.
+//
+// Requires cpuid.c to be included first.
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <x86intrin.h>
+
+enum X64PmuCounter {
+    X64_PMU_INSTRUCTIONS    = 0,
+    X64_PMU_CYCLES          = 1,
+    X64_PMU_LLC_MISSES      = 2,
+    X64_PMU_COUNTER_COUNT   = 3,
+};
+
+struct X64PmuEvent {
+    int                                     fd;
+    const volatile struct perf_event_mmap_page* page;
+};
+
+struct X64Profiler {
+    // One bit per X64PmuCounter that is open
+    uint32_t            counters;
+    // Open counters whose event the kernel let user space RDPMC when opened
+    uint32_t            rdpmcCounters;
+    struct X64PmuEvent  events[X64_PMU_COUNTER_COUNT];
+};
+
+// Counter values, 0 for counters that are not open
+struct X64PmuSample {
+    uint64_t    values[X64_PMU_COUNTER_COUNT];
+    // Counters this sample read with RDPMC, the others fell back to read()
+    uint32_t    rdpmcCounters;
+};
+
+// Counters of X64PmuCounter the PMU can count at the same time according to
+// leaf 0xA, one bit each. 0 if the CPU does not enumerate an architectural PMU
+uint32_t x64GetPmuCounters(const struct X64Info* cpuid) {
+    uint32_t generalPurpose = cpuid->pmuCounters;
+    uint32_t counters = 0;
+
+    // Fixed counter 0 counts instructions and fixed counter 1 core cycles,
+    // either falls back to a general purpose counter
+    if (cpuid->pmuEvents & X64_PMU_EVENT_INSTRUCTIONS) {
+        if (cpuid->pmuFixedCounterMask & 1) {
+            counters |= 1 << X64_PMU_INSTRUCTIONS;
+        } else if (generalPurpose > 0) {
+            counters |= 1 << X64_PMU_INSTRUCTIONS;
+            generalPurpose--;
+        }
+    }
+    if (cpuid->pmuEvents & X64_PMU_EVENT_CORE_CYCLES) {
+        if (cpuid->pmuFixedCounterMask & 2) {
+            counters |= 1 << X64_PMU_CYCLES;
+        } else if (generalPurpose > 0) {
+            counters |= 1 << X64_PMU_CYCLES;
+            generalPurpose--;
+        }
+    }
+    if ((cpuid->pmuEvents & X64_PMU_EVENT_LLC_MISSES) && generalPurpose > 0) {
+        counters |= 1 << X64_PMU_LLC_MISSES;
+    }
+    return counters;
+}
+
+#ifdef __linux__
+
+static uint64_t x64ReadPmuEventSlow(const struct X64PmuEvent* event) {
+    uint64_t count = 0;
+    return read(event->fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+}
+
+// Sets *rdpmc to whether the value came from RDPMC rather than read()
+static inline uint64_t x64ReadPmuEvent(const struct X64PmuEvent* event, bool* rdpmc) {
+    const volatile struct perf_event_mmap_page* page = event->page;
+    uint32_t sequence;
+    uint32_t index;
+    uint64_t count;
+    do {
+        sequence = page->lock;
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        index = page->cap_user_rdpmc ? page->index : 0;
+        count = page->offset;
+        if (index != 0) {
+            // Sign extend the pmc_width bit counter value before adding it
+            const uint32_t shift = 64 - page->pmc_width;
+            count += (uint64_t)((int64_t)((uint64_t)__rdpmc(index - 1) << shift) >> shift);
+        }
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+    } while (page->lock != sequence);
+
+    // Not currently on a hardware counter, or RDPMC is not permitted
+    *rdpmc = index != 0;
+    return index != 0 ? count : x64ReadPmuEventSlow(event);
+}
+
+// Opens the counters for the calling thread, user mode only. Returns false if
+// none could be opened, e.g. without a PMU or when perf_event_paranoid forbids it
+bool x64OpenProfiler(struct X64Profiler* profiler) {
+    static const uint64_t configs[X64_PMU_COUNTER_COUNT] = {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+
+    *profiler = (struct X64Profiler){};
+    for (uint32_t i = 0; i < X64_PMU_COUNTER_COUNT; i++) {
+        profiler->events[i].fd = -1;
+    }
+
+    uint32_t planned = (1 << X64_PMU_COUNTER_COUNT) - 1;
+    if (x64InitCpuidCache() && x64Cpu()->pmuVersion != 0) {
+        planned = x64GetPmuCounters(x64Cpu());
+    }
+
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    int leader = -1;
+    for (uint32_t i = 0; i < X64_PMU_COUNTER_COUNT; i++) {
+        if (!(planned & (1 << i))) {
+            continue;
+        }
+
+        struct perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0) {
+            continue;
+        }
+        void* page = mmap(0, pageSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (page == MAP_FAILED) {
+            close(fd);
+            continue;
+        }
+
+        profiler->events[i].fd = fd;
+        profiler->events[i].page = page;
+        profiler->counters |= 1 << i;
+        if (profiler->events[i].page->cap_user_rdpmc) {
+            profiler->rdpmcCounters |= 1 << i;
+        }
+        if (leader < 0) {
+            leader = fd;
+        }
+    }
+
+    return profiler->counters != 0;
+}
+
+void x64CloseProfiler(struct X64Profiler* profiler) {
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    // Group members before their leader
+    for (uint32_t i = X64_PMU_COUNTER_COUNT; i-- > 0;) {
+        if (profiler->counters & (1 << i)) {
+            munmap((void*)profiler->events[i].page, pageSize);
+            close(profiler->events[i].fd);
+        }
+    }
+    *profiler = (struct X64Profiler){};
+}
+
+// Samples every open counter. Take one sample before and one after a region
+// and subtract
+static inline void x64ProfilerRead(const struct X64Profiler* profiler, struct X64PmuSample* sample) {
+    sample->rdpmcCounters = 0;
+    for (uint32_t i = 0; i < X64_PMU_COUNTER_COUNT; i++) {
+        bool rdpmc = false;
+        sample->values[i] = (profiler->counters & (1 << i)) ? x64ReadPmuEvent(&profiler->events[i], &rdpmc) : 0;
+        sample->rdpmcCounters |= (uint32_t)rdpmc << i;
+    }
+}
+
+#else
+
+bool x64OpenProfiler(struct X64Profiler* profiler) {
+    *profiler = (struct X64Profiler){};
+    return false;
+}
+
+void x64CloseProfiler(struct X64Profiler* profiler) {
+}
+
+static inline void x64ProfilerRead(const struct X64Profiler* profiler, struct X64PmuSample* sample) {
+    *sample = (struct X64PmuSample){};
+}
+
+#endif
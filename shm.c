@@ -0,0 +1,265 @@
+// Shared memory publication of X64Info and the topology.
+//
+// One publisher (`cpuid --daemon`) decodes the CPU once and writes the result
+// into a POSIX shared memory segment, /dev/shm/x64cpuid by default. Any number
+// of processes map it read-only. Reading costs no CPUID instruction and, after
+// the mmap, no system call.
+//
+// Updates are guarded by a seqlock: the publisher makes the sequence odd, writes,
+// then makes it even again. Readers copy and retry if the sequence was odd or
+// changed meanwhile. The sequence is only odd for the copy itself, so a reader
+// that sees it odd for X64_SHARED_SPIN_LIMIT pauses assumes the publisher died
+// mid-write and treats the segment as unpublished. The segment carries the layout
+// size as well as a version, so a reader built against a different X64Info
+// refuses it instead of misreading it.
+//
+// Requires cpuid.c and topology.c to be included first.
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define X64_SHARED_NAME     "/x64cpuid"
+#define X64_SHARED_MAGIC    "X64SHM"
+#define X64_SHARED_VERSION  1
+// A publish copies about 50 KB, far less time than this many pauses take
+#define X64_SHARED_SPIN_LIMIT   (1u << 22)
+
+struct X64SharedInfo {
+    char                    magic[8];
+    uint32_t                version;
+    uint32_t                layoutSize;
+    // Odd while the publisher is writing
+    uint32_t                sequence;
+    uint32_t                publisherPid;
+    uint64_t                publishCount;
+
+    struct X64Info          info;
+    // struct X64Topology with its CPUs stored inline
+    struct X64Topology      topology;
+    struct X64LogicalCpu    cpus[X64_MAX_CPUS];
+};
+
+struct X64SharedSegment {
+    struct X64SharedInfo*   shared;
+    bool                    writable;
+};
+
+// Waits for an even sequence. Returns false if it stays odd, i.e. the
+// publisher died while writing
+static inline bool x64SharedBeginRead(const struct X64SharedInfo* shared, uint32_t* sequence) {
+    for (uint32_t spin = 0; spin < X64_SHARED_SPIN_LIMIT; spin++) {
+        *sequence = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        if (!(*sequence & 1)) {
+            return true;
+        }
+        __builtin_ia32_pause();
+    }
+    return false;
+}
+
+static inline bool x64SharedEndRead(const struct X64SharedInfo* shared, uint32_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+#if defined(__unix__)
+
+static bool x64MapShared(const char* name, bool writable, struct X64SharedSegment* segment) {
+    *segment = (struct X64SharedSegment){};
+    int fd = writable ? shm_open(name, O_CREAT | O_RDWR, 0644) : shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    bool sized = writable ? ftruncate(fd, sizeof(struct X64SharedInfo)) == 0
+                          : fstat(fd, &st) == 0 && st.st_size == sizeof(struct X64SharedInfo);
+    void* data = MAP_FAILED;
+    if (sized) {
+        data = mmap(0, sizeof(struct X64SharedInfo), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    segment->shared = data;
+    segment->writable = writable;
+    return true;
+}
+
+void x64CloseShared(struct X64SharedSegment* segment) {
+    if (segment->shared) {
+        munmap(segment->shared, sizeof(struct X64SharedInfo));
+    }
+    *segment = (struct X64SharedSegment){};
+}
+
+bool x64UnlinkShared(const char* name) {
+    return shm_unlink(name) == 0;
+}
+
+#else
+
+static bool x64MapShared(const char* name, bool writable, struct X64SharedSegment* segment) {
+    *segment = (struct X64SharedSegment){};
+    return false;
+}
+
+void x64CloseShared(struct X64SharedSegment* segment) {
+    *segment = (struct X64SharedSegment){};
+}
+
+bool x64UnlinkShared(const char* name) {
+    return false;
+}
+
+#endif
+
+// -------------------------------------------------
+//                      Publisher
+// -------------------------------------------------
+
+// Creates or reuses the segment for writing. Readers reject a new segment until
+// the first publish sets the magic
+bool x64CreateShared(const char* name, struct X64SharedSegment* segment) {
+    if (!x64MapShared(name, true, segment)) {
+        return false;
+    }
+    // A previous publisher that died mid-write left the sequence odd and the
+    // snapshot torn. Withdraw the snapshot and release the sequence
+    struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence = __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED);
+    if (sequence & 1) {
+        memset(shared->magic, 0, sizeof(shared->magic));
+        __atomic_store_n(&shared->sequence, sequence + 1, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+// Writes a new snapshot. topology may be 0 if it could not be enumerated
+void x64PublishShared(struct X64SharedSegment* segment, const struct X64Info* info, const struct X64Topology* topology) {
+    struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence = __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&shared->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(shared->magic, X64_SHARED_MAGIC, sizeof(X64_SHARED_MAGIC));
+    shared->version = X64_SHARED_VERSION;
+    shared->layoutSize = sizeof(struct X64SharedInfo);
+#if defined(__unix__)
+    shared->publisherPid = getpid();
+#endif
+    shared->publishCount++;
+    shared->info = *info;
+    shared->topology = (struct X64Topology){};
+    if (topology) {
+        uint32_t cpuCount = topology->cpuCount < X64_MAX_CPUS ? topology->cpuCount : X64_MAX_CPUS;
+        shared->topology = *topology;
+        shared->topology.cpuCount = cpuCount;
+        memcpy(shared->cpus, topology->cpus, cpuCount * sizeof(struct X64LogicalCpu));
+    }
+    // The pointer is only meaningful in the reader's mapping
+    shared->topology.cpus = 0;
+
+    __atomic_store_n(&shared->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+// -------------------------------------------------
+//                      Readers
+// -------------------------------------------------
+
+// Maps a published segment read-only. Fails if no publisher ever completed a
+// snapshot, the publisher died while writing, or it was built with a different
+// layout
+bool x64OpenShared(const char* name, struct X64SharedSegment* segment) {
+    if (!x64MapShared(name, false, segment)) {
+        return false;
+    }
+
+    const struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence;
+    if (!x64SharedBeginRead(shared, &sequence)) {
+        x64CloseShared(segment);
+        return false;
+    }
+    bool valid = memcmp(shared->magic, X64_SHARED_MAGIC, sizeof(X64_SHARED_MAGIC)) == 0
+              && shared->version == X64_SHARED_VERSION
+              && shared->layoutSize == sizeof(struct X64SharedInfo);
+    if (!x64SharedEndRead(shared, sequence) || !valid) {
+        x64CloseShared(segment);
+        return false;
+    }
+    return true;
+}
+
+// Copies a consistent snapshot of the published X64Info. Returns false if the
+// publisher died while writing
+bool x64ReadSharedInfo(const struct X64SharedSegment* segment, struct X64Info* info) {
+    const struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence;
+    do {
+        if (!x64SharedBeginRead(shared, &sequence)) {
+            return false;
+        }
+        *info = shared->info;
+    } while (!x64SharedEndRead(shared, sequence));
+    return true;
+}
+
+// Copies the published topology. topology->cpus points into the mapping and
+// must not be released with x64FreeTopology(). Returns false if the publisher
+// died while writing
+bool x64ReadSharedTopology(const struct X64SharedSegment* segment, struct X64Topology* topology) {
+    const struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence;
+    do {
+        if (!x64SharedBeginRead(shared, &sequence)) {
+            *topology = (struct X64Topology){};
+            return false;
+        }
+        *topology = shared->topology;
+    } while (!x64SharedEndRead(shared, sequence));
+    topology->cpus = (struct X64LogicalCpu*)shared->cpus;
+    return true;
+}
+
+// Checks one feature without copying the whole snapshot. A segment whose
+// publisher died while writing has no features
+static inline bool x64SharedHasFeature(const struct X64SharedSegment* segment, enum X64Feature feature) {
+    const struct X64SharedInfo* shared = segment->shared;
+    uint32_t sequence;
+    bool has;
+    do {
+        if (!x64SharedBeginRead(shared, &sequence)) {
+            return false;
+        }
+        has = x64FeatureSetHas(&shared->info.features, feature);
+    } while (!x64SharedEndRead(shared, sequence));
+    return has;
+}
+
+// Like x64InitCpuidCache(), but fills the process wide snapshot from the
+// published segment when one is available, so x64Cpu() never executes CPUID.
+// Falls back to probing the CPU otherwise
+bool x64InitCpuidCacheFromShared(const char* name) {
+    uint32_t expected = X64_CACHE_STATE_UNINITIALIZED;
+    if (!__atomic_compare_exchange_n(&x64CacheState, &expected, X64_CACHE_STATE_INITIALIZING,
+                                     false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        return x64InitCpuidCache();
+    }
+
+    struct X64SharedSegment segment;
+    bool published = x64OpenShared(name, &segment);
+    if (published) {
+        published = x64ReadSharedInfo(&segment, &x64CachedInfo);
+        x64CloseShared(&segment);
+    }
+    x64CachedHasCpuid = published || getCpuidInfo(&x64CachedInfo);
+    __atomic_store_n(&x64CacheState, X64_CACHE_STATE_READY, __ATOMIC_RELEASE);
+    return x64CachedHasCpuid;
+}
@@ -0,0 +1,935 @@
+// Per logical CPU topology enumeration.
+//
+// Every online CPU gets a worker thread that is created already pinned to it,
+// so leaves 0x1F/0xB (or leaf 1/4 on older parts) are read on all CPUs
+// concurrently. The x2APIC IDs are then split into package/die/core/SMT IDs
+// using the shift widths the leaves report. On hybrid parts the same pass reads
+// leaf 0x1A, which only describes the core it executes on. On AMD it also
+// reads the node ID from leaf 0x8000001E and, on Zen 4 and later, the core
+// complex (CCX) and die (CCD) widths from leaf 0x80000026.
+//
+// Where the Linux cpuid driver is loaded (and readable, usually root only) the
+// leaves are read through /dev/cpu/N/cpuid instead, so no thread has to be
+// moved onto the CPUs a workload is running on.
+//
+// Requires cpuid.c to be included first.
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#define X64_MAX_CPUS    1024
+
+enum X64TopologyLevelType {
+    X64_TOPOLOGY_LEVEL_INVALID  = 0,
+    X64_TOPOLOGY_LEVEL_SMT      = 1,
+    X64_TOPOLOGY_LEVEL_CORE     = 2,
+    X64_TOPOLOGY_LEVEL_MODULE   = 3,
+    X64_TOPOLOGY_LEVEL_TILE     = 4,
+    X64_TOPOLOGY_LEVEL_DIE      = 5,
+    X64_TOPOLOGY_LEVEL_DIEGRP   = 6,
+};
+
+// Leaf 0x80000026 ECX[15:8]. Each level's shift yields the ID of that level
+enum X64AmdTopologyLevelType {
+    X64_AMD_TOPOLOGY_LEVEL_INVALID  = 0,
+    X64_AMD_TOPOLOGY_LEVEL_CORE     = 1,
+    X64_AMD_TOPOLOGY_LEVEL_COMPLEX  = 2,
+    X64_AMD_TOPOLOGY_LEVEL_DIE      = 3,
+    X64_AMD_TOPOLOGY_LEVEL_SOCKET   = 4,
+};
+
+// Leaf 0x1A EAX[31:24]
+enum X64CoreType {
+    X64_CORE_TYPE_UNKNOWN       = 0,
+    // Efficiency core
+    X64_CORE_TYPE_ATOM          = 0x20,
+    // Performance core
+    X64_CORE_TYPE_CORE          = 0x40,
+};
+
+// Set of OS CPU IDs, independent of cpu_set_t so it works on every platform
+struct X64CpuMask {
+    uint64_t    words[X64_MAX_CPUS / 64];
+};
+
+struct X64LogicalCpu {
+    uint32_t    osCpuId;
+    uint32_t    x2ApicId;
+    // IDs are relative to the enclosing level, e.g. coreId is unique within a die
+    uint32_t    packageId;
+    uint32_t    dieId;
+    uint32_t    coreId;
+    uint32_t    smtId;
+    // X64_CORE_TYPE_UNKNOWN unless the CPU is hybrid
+    uint8_t     coreType;
+    // Leaf 0x1A EAX[23:0], identifies the microarchitecture of this core type
+    uint32_t    nativeModelId;
+    // System wide IDs of the L2 and L3 caches this CPU shares: the lowest x2APIC
+    // ID of the sharing domain, from this CPU's leaf 4 sharing widths. CPUs with
+    // equal IDs share that cache, even where core types share differently
+    uint32_t    l2Id;
+    uint32_t    l3Id;
+    // System wide IDs of the core complex and die, again the lowest x2APIC ID of
+    // each. On AMD a CCX is the set of cores sharing one L3 and a CCD the chiplet
+    // holding one or two of them. Without leaf 0x80000026 these follow the L3
+    // and die levels
+    uint32_t    ccxId;
+    uint32_t    ccdId;
+    // AMD leaf 0x8000001E node ID, 0 on other vendors
+    uint32_t    nodeId;
+};
+
+struct X64Topology {
+    uint32_t                cpuCount;
+    uint32_t                packageCount;
+    uint32_t                dieCount;
+    uint32_t                coreCount;
+    uint32_t                l3Count;
+    uint32_t                ccxCount;
+    uint32_t                ccdCount;
+    // 0 unless leaf 0x8000001E is available
+    uint32_t                nodeCount;
+    // Leaf 7 EDX hybrid flag, cores may differ in type
+    bool                    isHybrid;
+    // Leaf the shifts below were taken from (0x1F, 0xB or 1)
+    uint32_t                sourceLeaf;
+    // Number of x2APIC ID bits below the core, die and package levels
+    uint8_t                 smtShift;
+    uint8_t                 dieShift;
+    uint8_t                 packageShift;
+    // Number of x2APIC ID bits below the L2 and L3 sharing domains of the first
+    // CPU. Hybrid core types may differ, the per CPU IDs account for that
+    uint8_t                 l2Shift;
+    uint8_t                 l3Shift;
+    uint8_t                 ccxShift;
+    uint8_t                 ccdShift;
+    struct X64LogicalCpu*   cpus;
+};
+
+struct X64ApicShifts {
+    uint32_t    sourceLeaf;
+    uint32_t    x2ApicId;
+    uint8_t     smtShift;
+    uint8_t     dieShift;
+    uint8_t     packageShift;
+    // Leaf 4 or 0x8000001D
+    uint8_t     l2Shift;
+    uint8_t     l3Shift;
+    // Leaf 7 EDX and 0x1A
+    bool        isHybrid;
+    uint8_t     coreType;
+    uint32_t    nativeModelId;
+    // Leaf 0x8000001E
+    bool        hasNodes;
+    uint32_t    extendedApicId;
+    uint32_t    nodeId;
+    uint8_t     threadsPerComputeUnit;
+    // Leaf 0x80000026, 0 when not reported
+    uint8_t     ccxShift;
+    uint8_t     ccdShift;
+};
+
+static uint8_t x64CeilLog2(uint32_t value) {
+    uint8_t shift = 0;
+    while ((1u << shift) < value) {
+        shift++;
+    }
+    return shift;
+}
+
+// Reads the AMD node ID and, where reported, the CCX and CCD widths of the
+// CPU backend reads
+static void x64ReadAmdTopology(const struct X64CpuidBackend* backend, struct X64ApicShifts* shifts) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0x80000000, 0, &result);
+    const uint32_t maxLeaf = result.eax;
+    if (maxLeaf < 0x8000001E || maxLeaf >= 0x80000100) {
+        return;
+    }
+    x64BackendCpuid(backend, 0x80000001, 0, &result);
+    if (!(result.ecx & X64_EXTENDED_FEATURE_FLAG_ECX_TOPOEXT)) {
+        return;
+    }
+
+    x64BackendCpuid(backend, 0x8000001E, 0, &result);
+    shifts->hasNodes = true;
+    shifts->extendedApicId = result.eax;
+    shifts->nodeId = result.ecx & 0xFF;
+    shifts->threadsPerComputeUnit = ((result.ebx >> 8) & 0xFF) + 1;
+
+    for (uint32_t subleaf = 0; maxLeaf >= 0x80000026 && subleaf < 256; subleaf++) {
+        x64BackendCpuid(backend, 0x80000026, subleaf, &result);
+        uint32_t levelType = (result.ecx >> 8) & 0xFF;
+        if (levelType == X64_AMD_TOPOLOGY_LEVEL_INVALID) {
+            break;
+        }
+        if (levelType == X64_AMD_TOPOLOGY_LEVEL_COMPLEX) {
+            shifts->ccxShift = result.eax & 0b11111;
+        } else if (levelType == X64_AMD_TOPOLOGY_LEVEL_DIE) {
+            shifts->ccdShift = result.eax & 0b11111;
+        }
+    }
+}
+
+// Reads the APIC ID and level shifts of the CPU backend reads
+static void x64ReadApicShifts(const struct X64CpuidBackend* backend, struct X64ApicShifts* shifts) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0, 0, &result);
+    const uint32_t maxLeaf = result.eax;
+    x64ReadAmdTopology(backend, shifts);
+
+    uint32_t leaf = 0;
+    if (maxLeaf >= 0x1F) {
+        x64BackendCpuid(backend, 0x1F, 0, &result);
+        if (result.ebx != 0) {
+            leaf = 0x1F;
+        }
+    }
+    if (leaf == 0 && maxLeaf >= 0xB) {
+        x64BackendCpuid(backend, 0xB, 0, &result);
+        if (result.ebx != 0) {
+            leaf = 0xB;
+        }
+    }
+
+    if (leaf != 0) {
+        bool hasDie = false;
+        uint8_t shift = 0;
+        for (uint32_t subleaf = 0; subleaf < 256; subleaf++) {
+            x64BackendCpuid(backend, leaf, subleaf, &result);
+            uint32_t levelType = (result.ecx >> 8) & 0xFF;
+            if (levelType == X64_TOPOLOGY_LEVEL_INVALID) {
+                break;
+            }
+
+            // A level's shift yields the ID of the level above it, so the die
+            // ID is what remains above the level below the die
+            const uint8_t lowerShift = shift;
+            shift = result.eax & 0b11111;
+            if (levelType == X64_TOPOLOGY_LEVEL_SMT) {
+                shifts->smtShift = shift;
+            } else if (levelType == X64_TOPOLOGY_LEVEL_DIE) {
+                shifts->dieShift = lowerShift;
+                hasDie = true;
+            }
+            shifts->x2ApicId = result.edx;
+        }
+
+        // Modules and tiles are folded into the core ID, die groups into the die ID
+        shifts->packageShift = shift;
+        if (!hasDie) {
+            shifts->dieShift = shift;
+        }
+        shifts->sourceLeaf = leaf;
+        return;
+    }
+
+    // Legacy fallback: 8-bit initial APIC ID and the addressable ID counts of
+    // leaf 1/4. AMD leaves leaf 4 empty but reports threads per core in 0x8000001E
+    x64BackendCpuid(backend, 1, 0, &result);
+    shifts->sourceLeaf = 1;
+    shifts->x2ApicId = shifts->hasNodes ? shifts->extendedApicId : result.ebx >> 24;
+    shifts->smtShift = 0;
+    shifts->packageShift = 0;
+    if (result.edx & X64_FEATURE_FLAG_ECX_HTT) {
+        shifts->packageShift = x64CeilLog2((result.ebx >> 16) & 0xFF);
+        if (maxLeaf >= 4) {
+            x64BackendCpuid(backend, 4, 0, &result);
+        }
+        if (maxLeaf >= 4 && (result.eax & 0b11111) != 0) {
+            uint8_t coreShift = x64CeilLog2((result.eax >> 26) + 1);
+            if (coreShift <= shifts->packageShift) {
+                shifts->smtShift = shifts->packageShift - coreShift;
+            }
+        } else if (shifts->hasNodes) {
+            shifts->smtShift = x64CeilLog2(shifts->threadsPerComputeUnit);
+        }
+    }
+    shifts->dieShift = shifts->packageShift;
+}
+
+// Reads the L2 and L3 sharing widths of the CPU backend reads. The cache
+// leaves report how many APIC IDs share a cache, rounded up to a power of two
+// that is the ID width of the sharing domain. They are read per CPU because
+// E-cores share one L2 per cluster while P-cores have their own. Requires the
+// APIC shifts, which stand in for a cache level the CPU does not report
+static void x64ReadCacheShifts(const struct X64CpuidBackend* backend, struct X64ApicShifts* shifts) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0, 0, &result);
+    uint32_t leaf = 0;
+    if (result.eax >= 4) {
+        x64BackendCpuid(backend, 4, 0, &result);
+        leaf = (result.eax & 0b11111) != X64_CACHE_TYPE_NULL ? 4 : 0;
+    }
+    // AMD does not implement leaf 4 but reports the same layout in 0x8000001D,
+    // which every CPU with leaf 0x8000001E has
+    if (leaf == 0 && shifts->hasNodes) {
+        leaf = 0x8000001D;
+    }
+
+    shifts->l2Shift = shifts->smtShift;
+    shifts->l3Shift = shifts->packageShift;
+    for (uint32_t subleaf = 0; leaf != 0 && subleaf < X64_MAX_CACHES; subleaf++) {
+        x64BackendCpuid(backend, leaf, subleaf, &result);
+        uint8_t type = result.eax & 0b11111;
+        if (type == X64_CACHE_TYPE_NULL) {
+            break;
+        }
+        uint8_t level = (result.eax >> 5) & 0b111;
+        uint8_t shift = x64CeilLog2(((result.eax >> 14) & 0xFFF) + 1);
+        if (type != X64_CACHE_TYPE_INSTRUCTION && level == 2) {
+            shifts->l2Shift = shift;
+        } else if (type != X64_CACHE_TYPE_INSTRUCTION && level == 3) {
+            shifts->l3Shift = shift;
+        }
+    }
+}
+
+// Reads the hybrid flag and core type of the CPU backend reads
+static void x64ReadCoreType(const struct X64CpuidBackend* backend, struct X64ApicShifts* shifts) {
+    struct X64CpuidResult result = {};
+    x64BackendCpuid(backend, 0, 0, &result);
+    const uint32_t maxLeaf = result.eax;
+    if (maxLeaf < 7) {
+        return;
+    }
+    x64BackendCpuid(backend, 7, 0, &result);
+    shifts->isHybrid = (result.edx & X64_STRUCTURED_FEATURE_FLAG_EDX_HYBRID) != 0;
+    if (!shifts->isHybrid || maxLeaf < 0x1A) {
+        return;
+    }
+
+    x64BackendCpuid(backend, 0x1A, 0, &result);
+    shifts->coreType = result.eax >> 24;
+    shifts->nativeModelId = result.eax & 0xFFFFFF;
+}
+
+static void x64FillLogicalCpu(const struct X64ApicShifts* shifts, struct X64LogicalCpu* cpu) {
+    const uint32_t apic = shifts->x2ApicId;
+    cpu->x2ApicId  = apic;
+    cpu->smtId     = apic & ((1u << shifts->smtShift) - 1);
+    cpu->coreId    = (apic >> shifts->smtShift) & ((1u << (shifts->dieShift - shifts->smtShift)) - 1);
+    cpu->dieId     = (apic >> shifts->dieShift) & ((1u << (shifts->packageShift - shifts->dieShift)) - 1);
+    cpu->packageId = shifts->packageShift >= 32 ? 0 : apic >> shifts->packageShift;
+    cpu->coreType  = shifts->coreType;
+    cpu->nativeModelId = shifts->nativeModelId;
+    cpu->nodeId    = shifts->nodeId;
+}
+
+static int x64CompareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts values and moves the distinct ones to the front. Returns their number
+static uint32_t x64SortDistinct(uint32_t* values, uint32_t count) {
+    qsort(values, count, sizeof(uint32_t), x64CompareU32);
+
+    uint32_t distinct = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i == 0 || values[i] != values[distinct - 1]) {
+            values[distinct++] = values[i];
+        }
+    }
+    return distinct;
+}
+
+// Number of distinct APIC ID prefixes after dropping the low shift bits
+static uint32_t x64CountDistinctDomains(const struct X64Topology* topology, uint8_t shift, uint32_t* scratch) {
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        scratch[i] = shift >= 32 ? 0 : topology->cpus[i].x2ApicId >> shift;
+    }
+    return x64SortDistinct(scratch, topology->cpuCount);
+}
+
+// Lowest x2APIC ID of the domain that is shift bits wide around apic
+static uint32_t x64DomainId(uint32_t apic, uint8_t shift) {
+    return shift >= 32 ? 0 : apic & ~((1u << shift) - 1);
+}
+
+// -------------------------------------------------
+//                  Per CPU execution
+// -------------------------------------------------
+
+typedef void (*X64PerCpuFn)(uint32_t index, uint32_t osCpuId, void* ctx);
+
+#ifdef __linux__
+
+// Collects the OS IDs of all CPUs this process may run on, in ascending order.
+// Returns the number of CPUs written to ids
+uint32_t x64GetOnlineCpus(uint32_t* ids, uint32_t maxIds) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE && count < maxIds; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            ids[count++] = cpu;
+        }
+    }
+    return count;
+}
+
+struct X64PerCpuWorker {
+    pthread_t       thread;
+    uint32_t        index;
+    uint32_t        osCpuId;
+    X64PerCpuFn     fn;
+    void*           ctx;
+};
+
+static void* x64PerCpuWorkerMain(void* arg) {
+    struct X64PerCpuWorker* worker = arg;
+    worker->fn(worker->index, worker->osCpuId, worker->ctx);
+    return 0;
+}
+
+// Runs fn once on each CPU in cpuIds, all in parallel. Each worker thread is
+// created with its affinity already set so it never executes on another CPU.
+// Returns false if any worker could not be pinned or started
+bool x64RunOnEachCpu(const uint32_t* cpuIds, uint32_t cpuCount, X64PerCpuFn fn, void* ctx) {
+    struct X64PerCpuWorker* workers = calloc(cpuCount, sizeof(struct X64PerCpuWorker));
+    if (!workers) {
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t started = 0;
+    for (; started < cpuCount; started++) {
+        struct X64PerCpuWorker* worker = &workers[started];
+        worker->index = started;
+        worker->osCpuId = cpuIds[started];
+        worker->fn = fn;
+        worker->ctx = ctx;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->osCpuId, &set);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        // Workers only execute a handful of CPUID instructions
+        pthread_attr_setstacksize(&attr, 64 * 1024);
+        bool created = pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0
+                    && pthread_create(&worker->thread, &attr, x64PerCpuWorkerMain, worker) == 0;
+        pthread_attr_destroy(&attr);
+        if (!created) {
+            ok = false;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, 0);
+    }
+    free(workers);
+    return ok;
+}
+
+#else
+
+uint32_t x64GetOnlineCpus(uint32_t* ids, uint32_t maxIds) {
+    return 0;
+}
+
+bool x64RunOnEachCpu(const uint32_t* cpuIds, uint32_t cpuCount, X64PerCpuFn fn, void* ctx) {
+    return false;
+}
+
+#endif
+
+// -------------------------------------------------
+//                  CPUID devices
+// -------------------------------------------------
+
+#define X64_CPUID_DEVICE_ROOT   "/dev/cpu"
+// Subleaf 0 of up to this many leaves per range is read with a single pread
+#define X64_CPUID_DEVICE_BATCH      64
+// Every pread is an IPI to the target CPU, so the devices are read by a few
+// threads at once
+#define X64_CPUID_DEVICE_WORKERS    16
+
+// Backend reading one CPU through the cpuid driver. A pread of 16 bytes at
+// offset subleaf << 32 | leaf executes CPUID on that CPU, and longer reads
+// return the following leaves, so the basic and extended ranges are fetched
+// with one pread each when the device is loaded.
+//
+// Regular files are read as a stand-in tree, see X64_CPUID_TREE_STRIDE
+struct X64CpuidDevice {
+    int                     fd;
+    uint32_t                osCpuId;
+    // Bytes per offset step, 1 for the driver and X64_CPUID_TREE_STRIDE for regular files
+    uint32_t                stride;
+    uint32_t                basicCount;
+    uint32_t                extendedCount;
+    struct X64CpuidResult   basic[X64_CPUID_DEVICE_BATCH];
+    struct X64CpuidResult   extended[X64_CPUID_DEVICE_BATCH];
+};
+
+static const char* x64CpuidDeviceRoot = X64_CPUID_DEVICE_ROOT;
+
+// Points the per CPU scans at another directory laid out like /dev/cpu, e.g. a
+// stand-in tree of regular files in tests. Scans then cover the CPUs of that
+// tree instead of the online CPUs. 0 always migrates threads instead
+void x64SetCpuidDeviceRoot(const char* root) {
+    x64CpuidDeviceRoot = root;
+}
+
+static bool x64IsStandInRoot() {
+    return x64CpuidDeviceRoot && strcmp(x64CpuidDeviceRoot, X64_CPUID_DEVICE_ROOT) != 0;
+}
+
+#ifdef __linux__
+
+// Collects the numeric CPU directories of a stand-in tree in ascending order
+static uint32_t x64GetTreeCpus(const char* root, uint32_t* ids, uint32_t maxIds) {
+    DIR* dir = opendir(root);
+    if (!dir) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && count < maxIds) {
+        char* end;
+        unsigned long id = strtoul(entry->d_name, &end, 10);
+        if (end != entry->d_name && *end == 0 && id < X64_MAX_CPUS) {
+            ids[count++] = (uint32_t)id;
+        }
+    }
+    closedir(dir);
+    qsort(ids, count, sizeof(uint32_t), x64CompareU32);
+    return count;
+}
+
+static bool x64ReadCpuidDevice(const struct X64CpuidDevice* device, uint32_t leaf, uint32_t subleaf,
+                               struct X64CpuidResult* results, uint32_t count) {
+    const size_t bytes = count * sizeof(struct X64CpuidResult);
+    const uint64_t offset = ((uint64_t)subleaf << 32 | leaf) * device->stride;
+    return pread(device->fd, results, bytes, (off_t)offset) == (ssize_t)bytes;
+}
+
+// Reads the subleaf 0 registers of leaves first to max, at most X64_CPUID_DEVICE_BATCH
+static uint32_t x64BatchCpuidDevice(const struct X64CpuidDevice* device, uint32_t first,
+                                    struct X64CpuidResult* results) {
+    if (!x64ReadCpuidDevice(device, first, 0, results, 1) || results[0].eax < first) {
+        return 0;
+    }
+    uint32_t count = results[0].eax - first + 1;
+    if (count > X64_CPUID_DEVICE_BATCH) {
+        count = X64_CPUID_DEVICE_BATCH;
+    }
+    return x64ReadCpuidDevice(device, first, 0, results, count) ? count : 1;
+}
+
+static void x64DeviceQuery(void* ctx, uint32_t leaf, uint32_t subleaf, struct X64CpuidResult* result) {
+    const struct X64CpuidDevice* device = ctx;
+    if (leaf == X64_PSEUDO_LEAF_XCR0 && device->stride == 1) {
+        // The driver cannot read XCR0, but the OS enables the same state
+        // components on every CPU. A stand-in tree stores the XCR0 of the host
+        // it was captured on as a record, and one without it reads as 0 rather
+        // than as this host's
+        x64BackendCpuid(&x64NativeBackend, leaf, subleaf, result);
+    } else if (subleaf == 0 && leaf < device->basicCount) {
+        *result = device->basic[leaf];
+    } else if (subleaf == 0 && leaf >= 0x80000000 && leaf - 0x80000000 < device->extendedCount) {
+        *result = device->extended[leaf - 0x80000000];
+    } else if (!x64ReadCpuidDevice(device, leaf, subleaf, result, 1)) {
+        *result = (struct X64CpuidResult){};
+    }
+}
+
+// Opens <root>/<osCpuId>/cpuid without reading from it, which costs no IPI
+static bool x64OpenCpuidDeviceFile(const char* root, uint32_t osCpuId, struct X64CpuidDevice* device) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%u/cpuid", root, osCpuId);
+    device->osCpuId = osCpuId;
+    device->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (device->fd < 0) {
+        return false;
+    }
+    device->stride = fstat(device->fd, &st) == 0 && S_ISREG(st.st_mode) ? X64_CPUID_TREE_STRIDE : 1;
+    return true;
+}
+
+// Fetches the batched leaves of an open device and sets backend up to read it
+static bool x64LoadCpuidDevice(struct X64CpuidDevice* device, struct X64CpuidBackend* backend) {
+    device->basicCount = x64BatchCpuidDevice(device, 0, device->basic);
+    device->extendedCount = x64BatchCpuidDevice(device, 0x80000000, device->extended);
+    if (device->basicCount == 0) {
+        return false;
+    }
+    backend->query = x64DeviceQuery;
+    backend->ctx = device;
+    return true;
+}
+
+// Opens <root>/<osCpuId>/cpuid and sets backend up to read it. Returns false if
+// the device does not exist or is not readable
+bool x64OpenCpuidDevice(const char* root, uint32_t osCpuId, struct X64CpuidDevice* device,
+                        struct X64CpuidBackend* backend) {
+    if (!x64OpenCpuidDeviceFile(root, osCpuId, device)) {
+        return false;
+    }
+    if (!x64LoadCpuidDevice(device, backend)) {
+        close(device->fd);
+        device->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void x64CloseCpuidDevice(struct X64CpuidDevice* device) {
+    if (device->fd >= 0) {
+        close(device->fd);
+    }
+    device->fd = -1;
+}
+
+typedef void (*X64PerCpuQueryFn)(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* backend, void* ctx);
+
+struct X64DeviceScan {
+    const uint32_t*         cpuIds;
+    uint32_t                cpuCount;
+    struct X64CpuidDevice*  devices;
+    X64PerCpuQueryFn        fn;
+    void*                   ctx;
+    uint32_t                next;
+    bool                    failed;
+};
+
+static void* x64DeviceScanWorkerMain(void* arg) {
+    struct X64DeviceScan* scan = arg;
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) < scan->cpuCount) {
+        struct X64CpuidBackend backend;
+        if (!x64LoadCpuidDevice(&scan->devices[i], &backend)) {
+            __atomic_store_n(&scan->failed, true, __ATOMIC_RELAXED);
+            continue;
+        }
+        scan->fn(i, scan->cpuIds[i], &backend, scan->ctx);
+    }
+    return 0;
+}
+
+// Runs fn for every opened device on a small pool of unpinned threads. The
+// calling thread takes part, so the scan completes even if no thread starts
+static bool x64ScanCpuidDevices(struct X64DeviceScan* scan) {
+    pthread_t workers[X64_CPUID_DEVICE_WORKERS - 1];
+    uint32_t workerCount = scan->cpuCount < X64_CPUID_DEVICE_WORKERS ? scan->cpuCount : X64_CPUID_DEVICE_WORKERS;
+    uint32_t started = 0;
+    while (started + 1 < workerCount && pthread_create(&workers[started], 0, x64DeviceScanWorkerMain, scan) == 0) {
+        started++;
+    }
+    x64DeviceScanWorkerMain(scan);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(workers[i], 0);
+    }
+    return !scan->failed;
+}
+
+#else
+
+static uint32_t x64GetTreeCpus(const char* root, uint32_t* ids, uint32_t maxIds) {
+    return 0;
+}
+
+static bool x64OpenCpuidDeviceFile(const char* root, uint32_t osCpuId, struct X64CpuidDevice* device) {
+    device->fd = -1;
+    return false;
+}
+
+bool x64OpenCpuidDevice(const char* root, uint32_t osCpuId, struct X64CpuidDevice* device,
+                        struct X64CpuidBackend* backend) {
+    device->fd = -1;
+    return false;
+}
+
+void x64CloseCpuidDevice(struct X64CpuidDevice* device) {
+}
+
+typedef void (*X64PerCpuQueryFn)(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* backend, void* ctx);
+
+struct X64DeviceScan {
+    const uint32_t*         cpuIds;
+    uint32_t                cpuCount;
+    struct X64CpuidDevice*  devices;
+    X64PerCpuQueryFn        fn;
+    void*                   ctx;
+};
+
+static bool x64ScanCpuidDevices(struct X64DeviceScan* scan) {
+    return false;
+}
+
+#endif
+
+// CPUs a per CPU scan covers: those of the stand-in tree if one is configured,
+// otherwise every CPU this process may run on
+uint32_t x64GetScanCpus(uint32_t* ids, uint32_t maxIds) {
+    if (x64IsStandInRoot()) {
+        return x64GetTreeCpus(x64CpuidDeviceRoot, ids, maxIds);
+    }
+    return x64GetOnlineCpus(ids, maxIds);
+}
+
+struct X64PerCpuQuery {
+    X64PerCpuQueryFn    fn;
+    void*               ctx;
+    // Index into the caller's cpuIds of each CPU migrated to
+    const uint32_t*     indices;
+};
+
+static void x64PerCpuQueryNative(uint32_t index, uint32_t osCpuId, void* ctx) {
+    struct X64PerCpuQuery* query = ctx;
+    query->fn(query->indices[index], osCpuId, &x64NativeBackend, query->ctx);
+}
+
+// Calls fn once for each CPU in cpuIds with a backend that reads that CPU,
+// possibly from several threads at once. If the cpuid device of every CPU can
+// be opened, a small thread pool reads the devices. CPUs whose device could not
+// be opened or read, e.g. a pread failing with EIO after the CPU went offline,
+// fall back to x64RunOnEachCpu() and the native backend, except for a stand-in
+// tree, which has no CPUs to migrate to. Returns false if the CPUs could not be
+// read
+bool x64QueryEachCpu(const uint32_t* cpuIds, uint32_t cpuCount, X64PerCpuQueryFn fn, void* ctx) {
+    struct X64CpuidDevice* devices = x64CpuidDeviceRoot ? calloc(cpuCount, sizeof(struct X64CpuidDevice)) : 0;
+    uint32_t opened = 0;
+    while (devices && opened < cpuCount && x64OpenCpuidDeviceFile(x64CpuidDeviceRoot, cpuIds[opened], &devices[opened])) {
+        opened++;
+    }
+
+    bool ok = false;
+    const bool scanned = devices && opened == cpuCount;
+    if (scanned) {
+        struct X64DeviceScan scan = { cpuIds, cpuCount, devices, fn, ctx };
+        ok = x64ScanCpuidDevices(&scan);
+    }
+    if (!ok && !x64IsStandInRoot()) {
+        // fn already ran for every device that loaded
+        uint32_t* indices = calloc(cpuCount, sizeof(uint32_t));
+        uint32_t* retryIds = calloc(cpuCount, sizeof(uint32_t));
+        uint32_t retryCount = 0;
+        for (uint32_t i = 0; indices && retryIds && i < cpuCount; i++) {
+            if (!scanned || devices[i].basicCount == 0) {
+                indices[retryCount] = i;
+                retryIds[retryCount++] = cpuIds[i];
+            }
+        }
+        struct X64PerCpuQuery query = { fn, ctx, indices };
+        ok = indices && retryIds && x64RunOnEachCpu(retryIds, retryCount, x64PerCpuQueryNative, &query);
+        free(indices);
+        free(retryIds);
+    }
+
+    for (uint32_t i = 0; i < opened; i++) {
+        x64CloseCpuidDevice(&devices[i]);
+    }
+    free(devices);
+    return ok;
+}
+
+// -------------------------------------------------
+//                  Topology
+// -------------------------------------------------
+
+struct X64TopologyScan {
+    struct X64ApicShifts*   shifts;
+};
+
+// Everything is read through the CPU's own backend, so a stand-in tree is never
+// mixed with the CPU this process runs on
+static void x64TopologyScanCpu(uint32_t index, uint32_t osCpuId, const struct X64CpuidBackend* backend, void* ctx) {
+    struct X64TopologyScan* scan = ctx;
+    x64ReadApicShifts(backend, &scan->shifts[index]);
+    x64ReadCacheShifts(backend, &scan->shifts[index]);
+    x64ReadCoreType(backend, &scan->shifts[index]);
+}
+
+void x64FreeTopology(struct X64Topology* topology) {
+    free(topology->cpus);
+    *topology = (struct X64Topology){};
+}
+
+// Enumerates all online logical CPUs. The caller owns topology->cpus and must
+// release it with x64FreeTopology(). Returns false if CPUID is unsupported or
+// the CPUs could not be scanned
+bool x64EnumerateTopology(struct X64Topology* topology) {
+    *topology = (struct X64Topology){};
+    if (!x64InitCpuidCache()) {
+        return false;
+    }
+
+    uint32_t cpuIds[X64_MAX_CPUS];
+    uint32_t cpuCount = x64GetScanCpus(cpuIds, X64_MAX_CPUS);
+    if (cpuCount == 0) {
+        return false;
+    }
+
+    struct X64TopologyScan scan = {};
+    scan.shifts = calloc(cpuCount, sizeof(struct X64ApicShifts));
+    topology->cpus = calloc(cpuCount, sizeof(struct X64LogicalCpu));
+    uint32_t* scratch = calloc(cpuCount, sizeof(uint32_t));
+    if (!scan.shifts || !topology->cpus || !scratch
+        || !x64QueryEachCpu(cpuIds, cpuCount, x64TopologyScanCpu, &scan)) {
+        free(scan.shifts);
+        free(scratch);
+        x64FreeTopology(topology);
+        return false;
+    }
+
+    topology->cpuCount = cpuCount;
+    // The APIC level widths are identical on every CPU of a coherent system,
+    // cache sharing widths may differ between core types
+    topology->sourceLeaf   = scan.shifts[0].sourceLeaf;
+    topology->smtShift     = scan.shifts[0].smtShift;
+    topology->dieShift     = scan.shifts[0].dieShift;
+    topology->packageShift = scan.shifts[0].packageShift;
+    topology->l2Shift      = scan.shifts[0].l2Shift;
+    topology->l3Shift      = scan.shifts[0].l3Shift;
+    topology->ccxShift     = scan.shifts[0].ccxShift ? scan.shifts[0].ccxShift : topology->l3Shift;
+    topology->ccdShift     = scan.shifts[0].ccdShift ? scan.shifts[0].ccdShift : topology->dieShift;
+    for (uint32_t i = 0; i < cpuCount; i++) {
+        const struct X64ApicShifts* shifts = &scan.shifts[i];
+        struct X64LogicalCpu* cpu = &topology->cpus[i];
+        cpu->osCpuId = cpuIds[i];
+        x64FillLogicalCpu(shifts, cpu);
+        cpu->l2Id  = x64DomainId(cpu->x2ApicId, shifts->l2Shift);
+        cpu->l3Id  = x64DomainId(cpu->x2ApicId, shifts->l3Shift);
+        cpu->ccxId = x64DomainId(cpu->x2ApicId, shifts->ccxShift ? shifts->ccxShift : shifts->l3Shift);
+        cpu->ccdId = x64DomainId(cpu->x2ApicId, shifts->ccdShift ? shifts->ccdShift : shifts->dieShift);
+        topology->isHybrid |= shifts->isHybrid;
+    }
+
+    for (uint32_t i = 0; i < cpuCount; i++) {
+        scratch[i] = topology->cpus[i].l3Id;
+    }
+    topology->l3Count = x64SortDistinct(scratch, cpuCount);
+    for (uint32_t i = 0; i < cpuCount; i++) {
+        scratch[i] = topology->cpus[i].ccxId;
+    }
+    topology->ccxCount = x64SortDistinct(scratch, cpuCount);
+    for (uint32_t i = 0; i < cpuCount; i++) {
+        scratch[i] = topology->cpus[i].ccdId;
+    }
+    topology->ccdCount = x64SortDistinct(scratch, cpuCount);
+
+    topology->coreCount    = x64CountDistinctDomains(topology, topology->smtShift, scratch);
+    topology->dieCount     = x64CountDistinctDomains(topology, topology->dieShift, scratch);
+    topology->packageCount = x64CountDistinctDomains(topology, topology->packageShift, scratch);
+    if (scan.shifts[0].hasNodes) {
+        for (uint32_t i = 0; i < cpuCount; i++) {
+            scratch[i] = topology->cpus[i].nodeId;
+        }
+        topology->nodeCount = x64SortDistinct(scratch, cpuCount);
+    }
+
+    free(scan.shifts);
+    free(scratch);
+    return true;
+}
+
+// -------------------------------------------------
+//                  CPU masks
+// -------------------------------------------------
+
+static inline void x64CpuMaskSet(struct X64CpuMask* mask, uint32_t osCpuId) {
+    if (osCpuId < X64_MAX_CPUS) {
+        mask->words[osCpuId / 64] |= 1ull << (osCpuId % 64);
+    }
+}
+
+static inline bool x64CpuMaskHas(const struct X64CpuMask* mask, uint32_t osCpuId) {
+    return osCpuId < X64_MAX_CPUS && (mask->words[osCpuId / 64] >> (osCpuId % 64)) & 1;
+}
+
+uint32_t x64CpuMaskCount(const struct X64CpuMask* mask) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < X64_MAX_CPUS / 64; i++) {
+        count += __builtin_popcountll(mask->words[i]);
+    }
+    return count;
+}
+
+// Collects the CPUs of one core type. Returns the number of CPUs in mask
+uint32_t x64GetCoreTypeMask(const struct X64Topology* topology, enum X64CoreType type, struct X64CpuMask* mask) {
+    *mask = (struct X64CpuMask){};
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        if (topology->cpus[i].coreType == type) {
+            x64CpuMaskSet(mask, topology->cpus[i].osCpuId);
+        }
+    }
+    return x64CpuMaskCount(mask);
+}
+
+// Collects the CPUs of the L3 domain at index, counted in ascending l3Id order
+// from 0 to topology->l3Count - 1. Threads placed within one mask share their
+// last level cache, which on AMD means they stay inside one CCX. Returns the
+// number of CPUs in mask, 0 if index is out of range
+uint32_t x64GetL3DomainMask(const struct X64Topology* topology, uint32_t index, struct X64CpuMask* mask) {
+    *mask = (struct X64CpuMask){};
+    uint32_t l3Ids[X64_MAX_CPUS];
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        l3Ids[i] = topology->cpus[i].l3Id;
+    }
+    if (index >= x64SortDistinct(l3Ids, topology->cpuCount)) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        if (topology->cpus[i].l3Id == l3Ids[index]) {
+            x64CpuMaskSet(mask, topology->cpus[i].osCpuId);
+        }
+    }
+    return x64CpuMaskCount(mask);
+}
+
+// CPUs latency critical threads should run on. On hybrid parts these are the
+// performance cores, otherwise every CPU qualifies. Returns the number of CPUs
+// in mask
+uint32_t x64GetPerformanceCoreMask(const struct X64Topology* topology, struct X64CpuMask* mask) {
+    if (topology->isHybrid && x64GetCoreTypeMask(topology, X64_CORE_TYPE_CORE, mask) > 0) {
+        return x64CpuMaskCount(mask);
+    }
+
+    *mask = (struct X64CpuMask){};
+    for (uint32_t i = 0; i < topology->cpuCount; i++) {
+        x64CpuMaskSet(mask, topology->cpus[i].osCpuId);
+    }
+    return x64CpuMaskCount(mask);
+}
+
+#ifdef __linux__
+
+// Restricts the calling thread to the CPUs in mask
+bool x64PinCurrentThread(const struct X64CpuMask* mask) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu = 0; cpu < X64_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (x64CpuMaskHas(mask, cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+
+bool x64PinCurrentThread(const struct X64CpuMask* mask) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,92 @@
+// TSC based clock.
+//
+// With an invariant TSC the tick rate is fixed and identical on every core,
+// so a timestamp is one RDTSC plus a multiply and shift, with no vDSO call.
+// The tick rate comes from leaves 0x15/0x16. Only parts that enumerate neither
+// are calibrated, once, against the OS clock at initialization.
+//
+// When the TSC is not invariant the clock stays disabled and x64TscClockNow()
+// falls back to the OS monotonic clock, so callers never need two code paths.
+//
+// Requires cpuid.c to be included first.
+
+#include <time.h>
+#include <x86intrin.h>
+
+// Conversion factors are 32.32 fixed point nanoseconds per tick
+#define X64_TSC_SHIFT               32
+#define X64_TSC_CALIBRATION_NS      20000000ull
+
+struct X64TscClock {
+    bool        enabled;
+    // Frequency was measured instead of read from CPUID
+    bool        calibrated;
+    uint64_t    tscHz;
+    uint64_t    nsPerTick;
+    // Tick and OS time sampled together at initialization
+    uint64_t    baseTsc;
+    uint64_t    baseNs;
+};
+
+static inline uint64_t x64OsClockNs() {
+    struct timespec ts;
+#if defined(__unix__)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Measures the TSC rate against the OS clock
+static uint64_t x64CalibrateTsc() {
+    uint64_t startNs = x64OsClockNs();
+    uint64_t startTsc = __rdtsc();
+    uint64_t elapsedNs = 0;
+    do {
+        elapsedNs = x64OsClockNs() - startNs;
+    } while (elapsedNs < X64_TSC_CALIBRATION_NS);
+    uint64_t ticks = __rdtsc() - startTsc;
+    return (uint64_t)((unsigned __int128)ticks * 1000000000ull / elapsedNs);
+}
+
+// Returns true if the TSC clock is in use. Otherwise clock is set up to read
+// the OS clock
+bool x64InitTscClock(struct X64TscClock* clock) {
+    *clock = (struct X64TscClock){};
+    if (!x64InitCpuidCache()) {
+        return false;
+    }
+
+    const struct X64Info* cpuid = x64Cpu();
+    if (!(cpuid->powerFeatures & X64_POWER_FLAG_EDX_INVARIANT_TSC)) {
+        return false;
+    }
+
+    clock->tscHz = x64GetTscFrequency(cpuid);
+    if (clock->tscHz == 0) {
+        clock->tscHz = x64CalibrateTsc();
+        clock->calibrated = true;
+    }
+    if (clock->tscHz == 0) {
+        return false;
+    }
+
+    clock->nsPerTick = (1000000000ull << X64_TSC_SHIFT) / clock->tscHz;
+    clock->baseNs = x64OsClockNs();
+    clock->baseTsc = __rdtsc();
+    clock->enabled = true;
+    return true;
+}
+
+static inline uint64_t x64TscToNs(const struct X64TscClock* clock, uint64_t ticks) {
+    return (uint64_t)(((unsigned __int128)ticks * clock->nsPerTick) >> X64_TSC_SHIFT);
+}
+
+// Monotonic nanoseconds, on the same timeline as CLOCK_MONOTONIC
+static inline uint64_t x64TscClockNow(const struct X64TscClock* clock) {
+    if (!clock->enabled) {
+        return x64OsClockNs();
+    }
+    return clock->baseNs + x64TscToNs(clock, __rdtsc() - clock->baseTsc);
+}
@@ -0,0 +1,775 @@
+// Machine readable serialization of X64Info.
+//
+// Everything is formatted into one caller provided buffer, so serializing
+// allocates nothing and the finished output goes out in a single write.
+// Two formats are supported:
+//
+//   JSON    one object, field names match the X64Info members. Related
+//           members (TLBs, PMU, XSAVE, frequencies, ...) are grouped in objects
+//   Binary  "X64INFO" magic and a version, followed by tagged records
+//           (u16 tag, u16 length, payload), little endian. Readers skip tags
+//           they do not know, so fields can be added without a version bump.
+//           x64ReadInfoBinary turns the records back into an X64Info
+//
+// Requires cpuid.c to be included first.
+
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+#define X64_INFO_BINARY_MAGIC       "X64INFO"
+#define X64_INFO_BINARY_VERSION     1
+
+enum X64InfoTag {
+    X64_INFO_TAG_VENDOR             = 1,
+    X64_INFO_TAG_BRAND              = 2,
+    X64_INFO_TAG_MAX_BASIC_LEAF     = 3,
+    X64_INFO_TAG_MAX_EXTENDED_LEAF  = 4,
+    // u32 family, u32 model, u32 stepping, u32 processor type, u32 brand index
+    X64_INFO_TAG_SIGNATURE          = 5,
+    X64_INFO_TAG_CACHE_LINE_SIZE    = 6,
+    X64_INFO_TAG_INITIAL_APIC_ID    = 7,
+    X64_INFO_TAG_MAX_LOGICAL_IDS    = 8,
+    X64_INFO_TAG_XCR0               = 9,
+    // struct X64FeatureSet words
+    X64_INFO_TAG_FEATURES           = 10,
+    X64_INFO_TAG_USABLE_FEATURES    = 11,
+    X64_INFO_TAG_MICROARCH_LEVEL    = 12,
+    X64_INFO_TAG_LEAF2_DESCRIPTORS  = 13,
+    // Repeated once per cache: u8 level, u8 type, u8 flags, u8 reserved,
+    // u16 line size, u16 ways, u16 partitions, u16 threads sharing, u32 sets, u32 size
+    X64_INFO_TAG_CACHE              = 14,
+    X64_INFO_TAG_TSC_HZ             = 15,
+    // u32 hypervisor, u32 max leaf, u32 features, u32 hints, the vendor string,
+    // then u32 spin retries
+    X64_INFO_TAG_HYPERVISOR         = 16,
+    // u8 model, u8 family, u8 extended model, u8 extended family as encoded in
+    // leaf 1, SIGNATURE carries the display values
+    X64_INFO_TAG_MODEL_IDS          = 17,
+    // u32 feature1, feature2, max structured subleaf, structured features 1-4,
+    // extended features 1-2, power features
+    X64_INFO_TAG_REGISTERS          = 18,
+    X64_INFO_TAG_HAS_EXTENDED_INFO  = 19,
+    X64_INFO_TAG_CACHE_LEAF         = 20,
+    X64_INFO_TAG_TLB_LEAF           = 21,
+    // Repeated once per TLB: u8 level, u8 type, u8 page sizes, u8 fully
+    // associative, u16 ways, u16 threads sharing, u32 entries
+    X64_INFO_TAG_TLB                = 22,
+    // u8 version, u8 counters, u8 counter width, u8 fixed counters, u8 fixed
+    // counter width, 3 reserved, u32 events, u32 fixed counter mask
+    X64_INFO_TAG_PMU                = 23,
+    // u64 supported components, u64 supervisor components, u32 enabled size,
+    // u32 max size, u32 features, u32 compacted size
+    X64_INFO_TAG_XSAVE              = 24,
+    // Repeated once per non-empty component: u32 component, u32 size,
+    // u32 offset, u8 supervisor, u8 aligned, 2 reserved
+    X64_INFO_TAG_XSAVE_COMPONENT    = 25,
+    // u32 TSC denominator, u32 TSC numerator, u32 crystal Hz, u32 hypervisor
+    // TSC kHz, u16 base MHz, u16 max MHz, u16 bus MHz, 2 reserved
+    X64_INFO_TAG_FREQUENCY          = 26,
+    // u32 package threads, u32 extended APIC ID, u8 APIC ID core ID size,
+    // u8 compute unit ID, u8 threads per compute unit, u8 node ID,
+    // u8 nodes per package, 3 reserved
+    X64_INFO_TAG_AMD_TOPOLOGY       = 27,
+};
+
+struct X64Writer {
+    char*       buffer;
+    size_t      capacity;
+    size_t      length;
+    // Set once a put did not fit, the output is truncated
+    bool        overflow;
+};
+
+void x64WriterInit(struct X64Writer* writer, char* buffer, size_t capacity) {
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->overflow = false;
+}
+
+void x64WriterPutBytes(struct X64Writer* writer, const void* data, size_t size) {
+    if (writer->capacity - writer->length < size) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(&writer->buffer[writer->length], data, size);
+    writer->length += size;
+}
+
+static inline void x64WriterPutChar(struct X64Writer* writer, char c) {
+    x64WriterPutBytes(writer, &c, 1);
+}
+
+void x64WriterPutString(struct X64Writer* writer, const char* string) {
+    x64WriterPutBytes(writer, string, strlen(string));
+}
+
+void x64WriterPutU64(struct X64Writer* writer, uint64_t value) {
+    char digits[20];
+    uint32_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    x64WriterPutBytes(writer, &digits[sizeof(digits) - count], count);
+}
+
+void x64WriterPutHex(struct X64Writer* writer, uint64_t value) {
+    char digits[18];
+    uint32_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    } while (value);
+    digits[sizeof(digits) - ++count] = 'x';
+    digits[sizeof(digits) - ++count] = '0';
+    x64WriterPutBytes(writer, &digits[sizeof(digits) - count], count);
+}
+
+// Writes a quoted JSON string of at most maxLength bytes. CPUID strings are
+// padded with spaces or NULs, both of which are trimmed
+void x64WriterPutJsonString(struct X64Writer* writer, const char* string, size_t maxLength) {
+    size_t length = 0;
+    while (length < maxLength && string[length]) {
+        length++;
+    }
+    while (length > 0 && string[length - 1] == ' ') {
+        length--;
+    }
+    size_t start = 0;
+    while (start < length && string[start] == ' ') {
+        start++;
+    }
+
+    x64WriterPutChar(writer, '"');
+    for (size_t i = start; i < length; i++) {
+        unsigned char c = string[i];
+        if (c == '"' || c == '\\') {
+            x64WriterPutChar(writer, '\\');
+            x64WriterPutChar(writer, c);
+        } else if (c < 0x20) {
+            x64WriterPutString(writer, "\\u00");
+            x64WriterPutChar(writer, "0123456789abcdef"[c >> 4]);
+            x64WriterPutChar(writer, "0123456789abcdef"[c & 0xF]);
+        } else {
+            x64WriterPutChar(writer, c);
+        }
+    }
+    x64WriterPutChar(writer, '"');
+}
+
+static void x64WriterPutJsonKey(struct X64Writer* writer, const char* key, bool first) {
+    if (!first) {
+        x64WriterPutChar(writer, ',');
+    }
+    x64WriterPutChar(writer, '"');
+    x64WriterPutString(writer, key);
+    x64WriterPutString(writer, "\":");
+}
+
+static void x64WriterPutJsonU64(struct X64Writer* writer, const char* key, uint64_t value) {
+    x64WriterPutJsonKey(writer, key, false);
+    x64WriterPutU64(writer, value);
+}
+
+static void x64WriterPutJsonBool(struct X64Writer* writer, const char* key, bool value) {
+    x64WriterPutJsonKey(writer, key, false);
+    x64WriterPutString(writer, value ? "true" : "false");
+}
+
+// Writes the whole buffer to fd, normally with exactly one write call
+bool x64WriterFlush(struct X64Writer* writer, int fd) {
+    size_t written = 0;
+    while (written < writer->length) {
+#if defined(__unix__)
+        ssize_t result = write(fd, &writer->buffer[written], writer->length - written);
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+#else
+        FILE* stream = fd == 2 ? stderr : stdout;
+        if (fwrite(&writer->buffer[written], writer->length - written, 1, stream) != 1) {
+            return false;
+        }
+        fflush(stream);
+        written = writer->length;
+#endif
+    }
+    writer->length = 0;
+    return !writer->overflow;
+}
+
+// -------------------------------------------------
+//                      JSON
+// -------------------------------------------------
+
+static void x64WriteJsonFeatureNames(struct X64Writer* writer, const struct X64FeatureSet* features) {
+    x64WriterPutChar(writer, '[');
+    bool first = true;
+    for (uint32_t feature = 0; feature < X64_FEATURE_BITS; feature++) {
+        if (!x64FeatureSetHas(features, feature) || !x64FeatureNames[feature]) {
+            continue;
+        }
+        if (!first) {
+            x64WriterPutChar(writer, ',');
+        }
+        x64WriterPutJsonString(writer, x64FeatureNames[feature], SIZE_MAX);
+        first = false;
+    }
+    x64WriterPutChar(writer, ']');
+}
+
+void x64WriteInfoJson(struct X64Writer* writer, const struct X64Info* cpuid) {
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "vendorString", true);
+    x64WriterPutJsonString(writer, cpuid->vendorString, CPUID_VENDOR_STRING_SIZE);
+    x64WriterPutJsonKey(writer, "brandString", false);
+    x64WriterPutJsonString(writer, cpuid->brandString, CPUID_BRAND_STRING_SIZE);
+    x64WriterPutJsonU64(writer, "maxInputBasicInfo", cpuid->maxInputBasicInfo);
+    x64WriterPutJsonU64(writer, "maxExtendedLeaf", cpuid->maxExtendedLeaf);
+    x64WriterPutJsonU64(writer, "family", x64GetDisplayFamily(cpuid));
+    x64WriterPutJsonU64(writer, "model", x64GetDisplayModel(cpuid));
+    x64WriterPutJsonU64(writer, "modelId", cpuid->modelId);
+    x64WriterPutJsonU64(writer, "familyId", cpuid->familyId);
+    x64WriterPutJsonU64(writer, "extendedModelId", cpuid->extendedModelId);
+    x64WriterPutJsonU64(writer, "extendedFamilyId", cpuid->extendedFamilyId);
+    x64WriterPutJsonU64(writer, "steppingId", cpuid->steppingId);
+    x64WriterPutJsonU64(writer, "processorType", cpuid->processorType);
+    x64WriterPutJsonU64(writer, "brandIndex", cpuid->brandIndex);
+    x64WriterPutJsonU64(writer, "cacheLineSize", cpuid->cacheLineSize);
+    x64WriterPutJsonU64(writer, "maxNumberLogicalProcessorIds", cpuid->maxNumberLogicalProcessorIds);
+    x64WriterPutJsonU64(writer, "initialApicId", cpuid->initialApicId);
+    x64WriterPutJsonU64(writer, "xcr0", cpuid->xcr0);
+    x64WriterPutJsonBool(writer, "hasExtendedInfo", cpuid->hasExtendedInfo);
+    x64WriterPutJsonU64(writer, "microarchLevel", x64GetMicroarchLevel(cpuid));
+    x64WriterPutJsonU64(writer, "tscHz", x64GetTscFrequency(cpuid));
+    x64WriterPutJsonKey(writer, "hypervisor", false);
+    x64WriterPutJsonString(writer, x64HypervisorName(cpuid->hypervisor), SIZE_MAX);
+    x64WriterPutJsonKey(writer, "hypervisorVendor", false);
+    x64WriterPutJsonString(writer, cpuid->hypervisorVendor, CPUID_VENDOR_STRING_SIZE);
+    x64WriterPutJsonU64(writer, "hypervisorMaxLeaf", cpuid->hypervisorMaxLeaf);
+    x64WriterPutJsonU64(writer, "hypervisorFeatures", cpuid->hypervisorFeatures);
+    x64WriterPutJsonU64(writer, "hypervisorHints", cpuid->hypervisorHints);
+    x64WriterPutJsonU64(writer, "hypervisorSpinRetries", cpuid->hypervisorSpinRetries);
+
+    x64WriterPutJsonKey(writer, "registers", false);
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "feature1", true);
+    x64WriterPutU64(writer, cpuid->feature1);
+    x64WriterPutJsonU64(writer, "feature2", cpuid->feature2);
+    x64WriterPutJsonU64(writer, "maxStructuredSubleaf", cpuid->maxStructuredSubleaf);
+    x64WriterPutJsonU64(writer, "structuredFeature1", cpuid->structuredFeature1);
+    x64WriterPutJsonU64(writer, "structuredFeature2", cpuid->structuredFeature2);
+    x64WriterPutJsonU64(writer, "structuredFeature3", cpuid->structuredFeature3);
+    x64WriterPutJsonU64(writer, "structuredFeature4", cpuid->structuredFeature4);
+    x64WriterPutJsonU64(writer, "extendedFeature1", cpuid->extendedFeature1);
+    x64WriterPutJsonU64(writer, "extendedFeature2", cpuid->extendedFeature2);
+    x64WriterPutJsonU64(writer, "powerFeatures", cpuid->powerFeatures);
+    x64WriterPutChar(writer, '}');
+
+    x64WriterPutJsonKey(writer, "features", false);
+    x64WriteJsonFeatureNames(writer, &cpuid->features);
+
+    // The usable tier has its own flag layout, map it through the feature names
+    struct X64FeatureSet usable = {};
+    const struct { uint32_t usable; enum X64Feature feature; } usableMap[] = {
+        { X64_USABLE_SSE, X64_FEATURE_SSE },                    { X64_USABLE_SSE2, X64_FEATURE_SSE2 },
+        { X64_USABLE_SSE3, X64_FEATURE_SSE3 },                  { X64_USABLE_SSSE3, X64_FEATURE_SSSE3 },
+        { X64_USABLE_SSE4_1, X64_FEATURE_SSE4_1 },              { X64_USABLE_SSE4_2, X64_FEATURE_SSE4_2 },
+        { X64_USABLE_AVX, X64_FEATURE_AVX },                    { X64_USABLE_F16C, X64_FEATURE_F16C },
+        { X64_USABLE_FMA, X64_FEATURE_FMA },                    { X64_USABLE_AVX2, X64_FEATURE_AVX2 },
+        { X64_USABLE_AVX512F, X64_FEATURE_AVX512F },            { X64_USABLE_AVX512CD, X64_FEATURE_AVX512CD },
+        { X64_USABLE_AVX512BW, X64_FEATURE_AVX512BW },          { X64_USABLE_AVX512DQ, X64_FEATURE_AVX512DQ },
+        { X64_USABLE_AVX512VL, X64_FEATURE_AVX512VL },          { X64_USABLE_AVX512_IFMA, X64_FEATURE_AVX512_IFMA },
+        { X64_USABLE_AVX512_VBMI, X64_FEATURE_AVX512_VBMI },    { X64_USABLE_AVX512_VBMI2, X64_FEATURE_AVX512_VBMI2 },
+        { X64_USABLE_AVX512_VNNI, X64_FEATURE_AVX512_VNNI },    { X64_USABLE_AVX512_BITALG, X64_FEATURE_AVX512_BITALG },
+        { X64_USABLE_AVX512_VPOPCNTDQ, X64_FEATURE_AVX512_VPOPCNTDQ },
+        { X64_USABLE_AVX512_FP16, X64_FEATURE_AVX512_FP16 },    { X64_USABLE_VAES, X64_FEATURE_VAES },
+        { X64_USABLE_VPCLMULQDQ, X64_FEATURE_VPCLMULQDQ },      { X64_USABLE_GFNI, X64_FEATURE_GFNI },
+        { X64_USABLE_AMX_TILE, X64_FEATURE_AMX_TILE },          { X64_USABLE_AMX_INT8, X64_FEATURE_AMX_INT8 },
+        { X64_USABLE_AMX_BF16, X64_FEATURE_AMX_BF16 },
+    };
+    for (uint32_t i = 0; i < sizeof(usableMap) / sizeof(usableMap[0]); i++) {
+        if (cpuid->usableFeatures & usableMap[i].usable) {
+            x64FeatureSetAdd(&usable, usableMap[i].feature);
+        }
+    }
+    x64WriterPutJsonKey(writer, "usableFeatures", false);
+    x64WriteJsonFeatureNames(writer, &usable);
+
+    x64WriterPutJsonKey(writer, "leaf2Descriptors", false);
+    x64WriterPutChar(writer, '[');
+    for (uint32_t i = 0; i < cpuid->leaf2DescriptorCount; i++) {
+        if (i > 0) {
+            x64WriterPutChar(writer, ',');
+        }
+        x64WriterPutU64(writer, cpuid->leaf2Descriptors[i]);
+    }
+    x64WriterPutChar(writer, ']');
+
+    x64WriterPutJsonU64(writer, "cacheLeaf", cpuid->cacheLeaf);
+    x64WriterPutJsonKey(writer, "caches", false);
+    x64WriterPutChar(writer, '[');
+    for (uint32_t i = 0; i < cpuid->cacheCount; i++) {
+        const struct X64CacheInfo* cache = &cpuid->caches[i];
+        if (i > 0) {
+            x64WriterPutChar(writer, ',');
+        }
+        x64WriterPutChar(writer, '{');
+        x64WriterPutJsonKey(writer, "level", true);
+        x64WriterPutU64(writer, cache->level);
+        x64WriterPutJsonU64(writer, "type", cache->type);
+        x64WriterPutJsonU64(writer, "sizeBytes", cache->sizeBytes);
+        x64WriterPutJsonU64(writer, "ways", cache->ways);
+        x64WriterPutJsonU64(writer, "lineSize", cache->lineSize);
+        x64WriterPutJsonU64(writer, "partitions", cache->partitions);
+        x64WriterPutJsonU64(writer, "sets", cache->sets);
+        x64WriterPutJsonU64(writer, "maxThreadsSharing", cache->maxThreadsSharing);
+        x64WriterPutJsonBool(writer, "inclusive", cache->inclusive);
+        x64WriterPutJsonBool(writer, "fullyAssociative", cache->fullyAssociative);
+        x64WriterPutJsonBool(writer, "selfInitializing", cache->selfInitializing);
+        x64WriterPutJsonBool(writer, "complexIndexing", cache->complexIndexing);
+        x64WriterPutChar(writer, '}');
+    }
+    x64WriterPutChar(writer, ']');
+
+    x64WriterPutJsonU64(writer, "tlbLeaf", cpuid->tlbLeaf);
+    x64WriterPutJsonKey(writer, "tlbs", false);
+    x64WriterPutChar(writer, '[');
+    for (uint32_t i = 0; i < cpuid->tlbCount; i++) {
+        const struct X64TlbInfo* tlb = &cpuid->tlbs[i];
+        if (i > 0) {
+            x64WriterPutChar(writer, ',');
+        }
+        x64WriterPutChar(writer, '{');
+        x64WriterPutJsonKey(writer, "level", true);
+        x64WriterPutU64(writer, tlb->level);
+        x64WriterPutJsonU64(writer, "type", tlb->type);
+        x64WriterPutJsonU64(writer, "pageSizes", tlb->pageSizes);
+        x64WriterPutJsonU64(writer, "entries", tlb->entries);
+        x64WriterPutJsonU64(writer, "ways", tlb->ways);
+        x64WriterPutJsonU64(writer, "maxThreadsSharing", tlb->maxThreadsSharing);
+        x64WriterPutJsonBool(writer, "fullyAssociative", tlb->fullyAssociative);
+        x64WriterPutChar(writer, '}');
+    }
+    x64WriterPutChar(writer, ']');
+
+    x64WriterPutJsonKey(writer, "pmu", false);
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "pmuVersion", true);
+    x64WriterPutU64(writer, cpuid->pmuVersion);
+    x64WriterPutJsonU64(writer, "pmuCounters", cpuid->pmuCounters);
+    x64WriterPutJsonU64(writer, "pmuCounterWidth", cpuid->pmuCounterWidth);
+    x64WriterPutJsonU64(writer, "pmuEvents", cpuid->pmuEvents);
+    x64WriterPutJsonU64(writer, "pmuFixedCounters", cpuid->pmuFixedCounters);
+    x64WriterPutJsonU64(writer, "pmuFixedCounterWidth", cpuid->pmuFixedCounterWidth);
+    x64WriterPutJsonU64(writer, "pmuFixedCounterMask", cpuid->pmuFixedCounterMask);
+    x64WriterPutChar(writer, '}');
+
+    x64WriterPutJsonKey(writer, "xsave", false);
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "xsaveSupportedComponents", true);
+    x64WriterPutU64(writer, cpuid->xsaveSupportedComponents);
+    x64WriterPutJsonU64(writer, "xsaveSupervisorComponents", cpuid->xsaveSupervisorComponents);
+    x64WriterPutJsonU64(writer, "xsaveEnabledSize", cpuid->xsaveEnabledSize);
+    x64WriterPutJsonU64(writer, "xsaveMaxSize", cpuid->xsaveMaxSize);
+    x64WriterPutJsonU64(writer, "xsaveFeatures", cpuid->xsaveFeatures);
+    x64WriterPutJsonU64(writer, "xsaveCompactedSize", cpuid->xsaveCompactedSize);
+    x64WriterPutJsonKey(writer, "xsaveComponents", false);
+    x64WriterPutChar(writer, '[');
+    bool firstComponent = true;
+    for (uint32_t i = 0; i < X64_MAX_XSAVE_COMPONENTS; i++) {
+        const struct X64XsaveComponent* component = &cpuid->xsaveComponents[i];
+        if (!component->size) {
+            continue;
+        }
+        if (!firstComponent) {
+            x64WriterPutChar(writer, ',');
+        }
+        x64WriterPutChar(writer, '{');
+        x64WriterPutJsonKey(writer, "component", true);
+        x64WriterPutU64(writer, i);
+        x64WriterPutJsonU64(writer, "size", component->size);
+        x64WriterPutJsonU64(writer, "offset", component->offset);
+        x64WriterPutJsonBool(writer, "supervisor", component->supervisor);
+        x64WriterPutJsonBool(writer, "aligned", component->aligned);
+        x64WriterPutChar(writer, '}');
+        firstComponent = false;
+    }
+    x64WriterPutString(writer, "]}");
+
+    x64WriterPutJsonKey(writer, "frequency", false);
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "tscDenominator", true);
+    x64WriterPutU64(writer, cpuid->tscDenominator);
+    x64WriterPutJsonU64(writer, "tscNumerator", cpuid->tscNumerator);
+    x64WriterPutJsonU64(writer, "crystalHz", cpuid->crystalHz);
+    x64WriterPutJsonU64(writer, "baseMhz", cpuid->baseMhz);
+    x64WriterPutJsonU64(writer, "maxMhz", cpuid->maxMhz);
+    x64WriterPutJsonU64(writer, "busMhz", cpuid->busMhz);
+    x64WriterPutJsonU64(writer, "hypervisorTscKhz", cpuid->hypervisorTscKhz);
+    x64WriterPutChar(writer, '}');
+
+    x64WriterPutJsonKey(writer, "amdTopology", false);
+    x64WriterPutChar(writer, '{');
+    x64WriterPutJsonKey(writer, "packageThreads", true);
+    x64WriterPutU64(writer, cpuid->packageThreads);
+    x64WriterPutJsonU64(writer, "apicIdCoreIdSize", cpuid->apicIdCoreIdSize);
+    x64WriterPutJsonU64(writer, "extendedApicId", cpuid->extendedApicId);
+    x64WriterPutJsonU64(writer, "computeUnitId", cpuid->computeUnitId);
+    x64WriterPutJsonU64(writer, "threadsPerComputeUnit", cpuid->threadsPerComputeUnit);
+    x64WriterPutJsonU64(writer, "nodeId", cpuid->nodeId);
+    x64WriterPutJsonU64(writer, "nodesPerPackage", cpuid->nodesPerPackage);
+    x64WriterPutChar(writer, '}');
+
+    x64WriterPutString(writer, "}\n");
+}
+
+// -------------------------------------------------
+//                      Binary
+// -------------------------------------------------
+
+static void x64WriterPutRecord(struct X64Writer* writer, enum X64InfoTag tag, const void* data, uint16_t size) {
+    uint16_t header[2] = { tag, size };
+    x64WriterPutBytes(writer, header, sizeof(header));
+    x64WriterPutBytes(writer, data, size);
+}
+
+static void x64WriterPutRecordU64(struct X64Writer* writer, enum X64InfoTag tag, uint64_t value) {
+    x64WriterPutRecord(writer, tag, &value, sizeof(value));
+}
+
+void x64WriteInfoBinary(struct X64Writer* writer, const struct X64Info* cpuid) {
+    const uint32_t version = X64_INFO_BINARY_VERSION;
+    x64WriterPutBytes(writer, X64_INFO_BINARY_MAGIC, sizeof(X64_INFO_BINARY_MAGIC));
+    x64WriterPutBytes(writer, &version, sizeof(version));
+
+    x64WriterPutRecord(writer, X64_INFO_TAG_VENDOR, cpuid->vendorString, CPUID_VENDOR_STRING_SIZE);
+    x64WriterPutRecord(writer, X64_INFO_TAG_BRAND, cpuid->brandString, CPUID_BRAND_STRING_SIZE);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_MAX_BASIC_LEAF, cpuid->maxInputBasicInfo);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_MAX_EXTENDED_LEAF, cpuid->maxExtendedLeaf);
+
+    const uint32_t signature[5] = {
+        x64GetDisplayFamily(cpuid), x64GetDisplayModel(cpuid), cpuid->steppingId,
+        cpuid->processorType, cpuid->brandIndex,
+    };
+    x64WriterPutRecord(writer, X64_INFO_TAG_SIGNATURE, signature, sizeof(signature));
+    const uint8_t modelIds[4] = { cpuid->modelId, cpuid->familyId, cpuid->extendedModelId, cpuid->extendedFamilyId };
+    x64WriterPutRecord(writer, X64_INFO_TAG_MODEL_IDS, modelIds, sizeof(modelIds));
+    const uint32_t registers[10] = {
+        cpuid->feature1, cpuid->feature2, cpuid->maxStructuredSubleaf,
+        cpuid->structuredFeature1, cpuid->structuredFeature2, cpuid->structuredFeature3, cpuid->structuredFeature4,
+        cpuid->extendedFeature1, cpuid->extendedFeature2, cpuid->powerFeatures,
+    };
+    x64WriterPutRecord(writer, X64_INFO_TAG_REGISTERS, registers, sizeof(registers));
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_HAS_EXTENDED_INFO, cpuid->hasExtendedInfo);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_CACHE_LINE_SIZE, cpuid->cacheLineSize);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_INITIAL_APIC_ID, cpuid->initialApicId);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_MAX_LOGICAL_IDS, cpuid->maxNumberLogicalProcessorIds);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_XCR0, cpuid->xcr0);
+    x64WriterPutRecord(writer, X64_INFO_TAG_FEATURES, cpuid->features.words, sizeof(cpuid->features.words));
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_USABLE_FEATURES, cpuid->usableFeatures);
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_MICROARCH_LEVEL, x64GetMicroarchLevel(cpuid));
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_TSC_HZ, x64GetTscFrequency(cpuid));
+    if (cpuid->hypervisor != X64_HYPERVISOR_NONE) {
+        uint8_t record[16 + CPUID_VENDOR_STRING_SIZE + 4];
+        const uint32_t words[4] = {
+            cpuid->hypervisor, cpuid->hypervisorMaxLeaf, cpuid->hypervisorFeatures, cpuid->hypervisorHints,
+        };
+        memcpy(record, words, sizeof(words));
+        memcpy(&record[16], cpuid->hypervisorVendor, CPUID_VENDOR_STRING_SIZE);
+        memcpy(&record[16 + CPUID_VENDOR_STRING_SIZE], &cpuid->hypervisorSpinRetries, 4);
+        x64WriterPutRecord(writer, X64_INFO_TAG_HYPERVISOR, record, sizeof(record));
+    }
+    x64WriterPutRecord(writer, X64_INFO_TAG_LEAF2_DESCRIPTORS, cpuid->leaf2Descriptors, cpuid->leaf2DescriptorCount);
+
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_CACHE_LEAF, cpuid->cacheLeaf);
+    for (uint32_t i = 0; i < cpuid->cacheCount; i++) {
+        const struct X64CacheInfo* cache = &cpuid->caches[i];
+        uint8_t record[20] = {};
+        uint16_t shorts[4] = { cache->lineSize, cache->ways, cache->partitions, cache->maxThreadsSharing };
+        uint32_t words[2] = { cache->sets, cache->sizeBytes };
+        record[0] = cache->level;
+        record[1] = cache->type;
+        record[2] = cache->inclusive | (cache->fullyAssociative << 1) | (cache->selfInitializing << 2)
+                  | (cache->complexIndexing << 3);
+        memcpy(&record[4], shorts, sizeof(shorts));
+        memcpy(&record[12], words, sizeof(words));
+        x64WriterPutRecord(writer, X64_INFO_TAG_CACHE, record, sizeof(record));
+    }
+
+    x64WriterPutRecordU64(writer, X64_INFO_TAG_TLB_LEAF, cpuid->tlbLeaf);
+    for (uint32_t i = 0; i < cpuid->tlbCount; i++) {
+        const struct X64TlbInfo* tlb = &cpuid->tlbs[i];
+        uint8_t record[12];
+        const uint16_t shorts[2] = { tlb->ways, tlb->maxThreadsSharing };
+        record[0] = tlb->level;
+        record[1] = tlb->type;
+        record[2] = tlb->pageSizes;
+        record[3] = tlb->fullyAssociative;
+        memcpy(&record[4], shorts, sizeof(shorts));
+        memcpy(&record[8], &tlb->entries, 4);
+        x64WriterPutRecord(writer, X64_INFO_TAG_TLB, record, sizeof(record));
+    }
+
+    {
+        uint8_t record[16] = {
+            cpuid->pmuVersion, cpuid->pmuCounters, cpuid->pmuCounterWidth,
+            cpuid->pmuFixedCounters, cpuid->pmuFixedCounterWidth,
+        };
+        memcpy(&record[8], &cpuid->pmuEvents, 4);
+        memcpy(&record[12], &cpuid->pmuFixedCounterMask, 4);
+        x64WriterPutRecord(writer, X64_INFO_TAG_PMU, record, sizeof(record));
+    }
+
+    {
+        uint8_t record[32];
+        const uint32_t words[4] = {
+            cpuid->xsaveEnabledSize, cpuid->xsaveMaxSize, cpuid->xsaveFeatures, cpuid->xsaveCompactedSize,
+        };
+        memcpy(record, &cpuid->xsaveSupportedComponents, 8);
+        memcpy(&record[8], &cpuid->xsaveSupervisorComponents, 8);
+        memcpy(&record[16], words, sizeof(words));
+        x64WriterPutRecord(writer, X64_INFO_TAG_XSAVE, record, sizeof(record));
+    }
+    for (uint32_t i = 0; i < X64_MAX_XSAVE_COMPONENTS; i++) {
+        const struct X64XsaveComponent* component = &cpuid->xsaveComponents[i];
+        if (!component->size && !component->offset && !component->supervisor && !component->aligned) {
+            continue;
+        }
+        uint8_t record[16] = {};
+        const uint32_t words[3] = { i, component->size, component->offset };
+        memcpy(record, words, sizeof(words));
+        record[12] = component->supervisor;
+        record[13] = component->aligned;
+        x64WriterPutRecord(writer, X64_INFO_TAG_XSAVE_COMPONENT, record, sizeof(record));
+    }
+
+    {
+        uint8_t record[24] = {};
+        const uint32_t words[4] = { cpuid->tscDenominator, cpuid->tscNumerator, cpuid->crystalHz, cpuid->hypervisorTscKhz };
+        const uint16_t shorts[3] = { cpuid->baseMhz, cpuid->maxMhz, cpuid->busMhz };
+        memcpy(record, words, sizeof(words));
+        memcpy(&record[16], shorts, sizeof(shorts));
+        x64WriterPutRecord(writer, X64_INFO_TAG_FREQUENCY, record, sizeof(record));
+    }
+
+    {
+        uint8_t record[16] = {};
+        memcpy(record, &cpuid->packageThreads, 4);
+        memcpy(&record[4], &cpuid->extendedApicId, 4);
+        record[8] = cpuid->apicIdCoreIdSize;
+        record[9] = cpuid->computeUnitId;
+        record[10] = cpuid->threadsPerComputeUnit;
+        record[11] = cpuid->nodeId;
+        record[12] = cpuid->nodesPerPackage;
+        x64WriterPutRecord(writer, X64_INFO_TAG_AMD_TOPOLOGY, record, sizeof(record));
+    }
+}
+
+// Reads the little endian integer of the given size at data
+static uint64_t x64ReadLe(const uint8_t* data, uint32_t size) {
+    uint64_t value = 0;
+    for (uint32_t i = size; i > 0; i--) {
+        value = value << 8 | data[i - 1];
+    }
+    return value;
+}
+
+// Parses the output of x64WriteInfoBinary back into cpuid. Unknown tags are
+// skipped, derived records (microarch level, TSC frequency) are recomputed by
+// their accessors. Returns false if the magic, version or a record is invalid
+bool x64ReadInfoBinary(const void* data, size_t size, struct X64Info* cpuid) {
+    const uint8_t* bytes = data;
+    const size_t headerSize = sizeof(X64_INFO_BINARY_MAGIC) + 4;
+    memset(cpuid, 0, sizeof(*cpuid));
+    if (size < headerSize || memcmp(bytes, X64_INFO_BINARY_MAGIC, sizeof(X64_INFO_BINARY_MAGIC)) != 0
+        || x64ReadLe(&bytes[sizeof(X64_INFO_BINARY_MAGIC)], 4) != X64_INFO_BINARY_VERSION) {
+        return false;
+    }
+
+    size_t offset = headerSize;
+    while (offset < size) {
+        if (size - offset < 4) {
+            return false;
+        }
+        const uint16_t tag = x64ReadLe(&bytes[offset], 2);
+        const uint16_t length = x64ReadLe(&bytes[offset + 2], 2);
+        const uint8_t* record = &bytes[offset + 4];
+        if (size - offset - 4 < length) {
+            return false;
+        }
+        offset += 4 + length;
+
+        // Smallest valid payload of each fixed layout tag
+        uint32_t minLength = 0;
+        switch (tag) {
+        case X64_INFO_TAG_VENDOR:               minLength = CPUID_VENDOR_STRING_SIZE; break;
+        case X64_INFO_TAG_BRAND:                minLength = CPUID_BRAND_STRING_SIZE; break;
+        case X64_INFO_TAG_MAX_BASIC_LEAF:
+        case X64_INFO_TAG_MAX_EXTENDED_LEAF:
+        case X64_INFO_TAG_CACHE_LINE_SIZE:
+        case X64_INFO_TAG_INITIAL_APIC_ID:
+        case X64_INFO_TAG_MAX_LOGICAL_IDS:
+        case X64_INFO_TAG_XCR0:
+        case X64_INFO_TAG_USABLE_FEATURES:
+        case X64_INFO_TAG_HAS_EXTENDED_INFO:
+        case X64_INFO_TAG_CACHE_LEAF:
+        case X64_INFO_TAG_TLB_LEAF:             minLength = 8; break;
+        case X64_INFO_TAG_SIGNATURE:            minLength = 20; break;
+        case X64_INFO_TAG_FEATURES:             minLength = sizeof(cpuid->features.words); break;
+        case X64_INFO_TAG_CACHE:                minLength = 20; break;
+        case X64_INFO_TAG_HYPERVISOR:           minLength = 16 + CPUID_VENDOR_STRING_SIZE; break;
+        case X64_INFO_TAG_MODEL_IDS:            minLength = 4; break;
+        case X64_INFO_TAG_REGISTERS:            minLength = 40; break;
+        case X64_INFO_TAG_TLB:                  minLength = 12; break;
+        case X64_INFO_TAG_PMU:                  minLength = 16; break;
+        case X64_INFO_TAG_XSAVE:                minLength = 32; break;
+        case X64_INFO_TAG_XSAVE_COMPONENT:      minLength = 16; break;
+        case X64_INFO_TAG_FREQUENCY:            minLength = 24; break;
+        case X64_INFO_TAG_AMD_TOPOLOGY:         minLength = 16; break;
+        }
+        if (length < minLength) {
+            return false;
+        }
+
+        switch (tag) {
+        case X64_INFO_TAG_VENDOR:
+            memcpy(cpuid->vendorString, record, CPUID_VENDOR_STRING_SIZE);
+            break;
+        case X64_INFO_TAG_BRAND:
+            memcpy(cpuid->brandString, record, CPUID_BRAND_STRING_SIZE);
+            break;
+        case X64_INFO_TAG_MAX_BASIC_LEAF:       cpuid->maxInputBasicInfo = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_MAX_EXTENDED_LEAF:    cpuid->maxExtendedLeaf = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_CACHE_LINE_SIZE:      cpuid->cacheLineSize = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_INITIAL_APIC_ID:      cpuid->initialApicId = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_MAX_LOGICAL_IDS:      cpuid->maxNumberLogicalProcessorIds = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_XCR0:                 cpuid->xcr0 = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_USABLE_FEATURES:      cpuid->usableFeatures = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_HAS_EXTENDED_INFO:    cpuid->hasExtendedInfo = x64ReadLe(record, 8) != 0; break;
+        case X64_INFO_TAG_CACHE_LEAF:           cpuid->cacheLeaf = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_TLB_LEAF:             cpuid->tlbLeaf = x64ReadLe(record, 8); break;
+        case X64_INFO_TAG_SIGNATURE:
+            // Family and model come from MODEL_IDS, the display values here are derived
+            cpuid->steppingId = x64ReadLe(&record[8], 4);
+            cpuid->processorType = x64ReadLe(&record[12], 4);
+            cpuid->brandIndex = x64ReadLe(&record[16], 4);
+            break;
+        case X64_INFO_TAG_MODEL_IDS:
+            cpuid->modelId = record[0];
+            cpuid->familyId = record[1];
+            cpuid->extendedModelId = record[2];
+            cpuid->extendedFamilyId = record[3];
+            break;
+        case X64_INFO_TAG_REGISTERS:
+            cpuid->feature1 = x64ReadLe(record, 4);
+            cpuid->feature2 = x64ReadLe(&record[4], 4);
+            cpuid->maxStructuredSubleaf = x64ReadLe(&record[8], 4);
+            cpuid->structuredFeature1 = x64ReadLe(&record[12], 4);
+            cpuid->structuredFeature2 = x64ReadLe(&record[16], 4);
+            cpuid->structuredFeature3 = x64ReadLe(&record[20], 4);
+            cpuid->structuredFeature4 = x64ReadLe(&record[24], 4);
+            cpuid->extendedFeature1 = x64ReadLe(&record[28], 4);
+            cpuid->extendedFeature2 = x64ReadLe(&record[32], 4);
+            cpuid->powerFeatures = x64ReadLe(&record[36], 4);
+            break;
+        case X64_INFO_TAG_FEATURES:
+            memcpy(cpuid->features.words, record, sizeof(cpuid->features.words));
+            break;
+        case X64_INFO_TAG_LEAF2_DESCRIPTORS:
+            cpuid->leaf2DescriptorCount = length < X64_MAX_LEAF2_DESCRIPTORS ? length : X64_MAX_LEAF2_DESCRIPTORS;
+            memcpy(cpuid->leaf2Descriptors, record, cpuid->leaf2DescriptorCount);
+            break;
+        case X64_INFO_TAG_CACHE:
+            if (cpuid->cacheCount < X64_MAX_CACHES) {
+                struct X64CacheInfo* cache = &cpuid->caches[cpuid->cacheCount++];
+                cache->level = record[0];
+                cache->type = record[1];
+                cache->inclusive = record[2] & 1;
+                cache->fullyAssociative = record[2] >> 1 & 1;
+                cache->selfInitializing = record[2] >> 2 & 1;
+                cache->complexIndexing = record[2] >> 3 & 1;
+                cache->lineSize = x64ReadLe(&record[4], 2);
+                cache->ways = x64ReadLe(&record[6], 2);
+                cache->partitions = x64ReadLe(&record[8], 2);
+                cache->maxThreadsSharing = x64ReadLe(&record[10], 2);
+                cache->sets = x64ReadLe(&record[12], 4);
+                cache->sizeBytes = x64ReadLe(&record[16], 4);
+            }
+            break;
+        case X64_INFO_TAG_HYPERVISOR:
+            cpuid->hypervisor = x64ReadLe(record, 4);
+            cpuid->hypervisorMaxLeaf = x64ReadLe(&record[4], 4);
+            cpuid->hypervisorFeatures = x64ReadLe(&record[8], 4);
+            cpuid->hypervisorHints = x64ReadLe(&record[12], 4);
+            memcpy(cpuid->hypervisorVendor, &record[16], CPUID_VENDOR_STRING_SIZE);
+            // Older writers stop after the vendor string
+            if (length >= 16 + CPUID_VENDOR_STRING_SIZE + 4) {
+                cpuid->hypervisorSpinRetries = x64ReadLe(&record[16 + CPUID_VENDOR_STRING_SIZE], 4);
+            }
+            break;
+        case X64_INFO_TAG_TLB:
+            if (cpuid->tlbCount < X64_MAX_TLBS) {
+                struct X64TlbInfo* tlb = &cpuid->tlbs[cpuid->tlbCount++];
+                tlb->level = record[0];
+                tlb->type = record[1];
+                tlb->pageSizes = record[2];
+                tlb->fullyAssociative = record[3] != 0;
+                tlb->ways = x64ReadLe(&record[4], 2);
+                tlb->maxThreadsSharing = x64ReadLe(&record[6], 2);
+                tlb->entries = x64ReadLe(&record[8], 4);
+            }
+            break;
+        case X64_INFO_TAG_PMU:
+            cpuid->pmuVersion = record[0];
+            cpuid->pmuCounters = record[1];
+            cpuid->pmuCounterWidth = record[2];
+            cpuid->pmuFixedCounters = record[3];
+            cpuid->pmuFixedCounterWidth = record[4];
+            cpuid->pmuEvents = x64ReadLe(&record[8], 4);
+            cpuid->pmuFixedCounterMask = x64ReadLe(&record[12], 4);
+            break;
+        case X64_INFO_TAG_XSAVE:
+            cpuid->xsaveSupportedComponents = x64ReadLe(record, 8);
+            cpuid->xsaveSupervisorComponents = x64ReadLe(&record[8], 8);
+            cpuid->xsaveEnabledSize = x64ReadLe(&record[16], 4);
+            cpuid->xsaveMaxSize = x64ReadLe(&record[20], 4);
+            cpuid->xsaveFeatures = x64ReadLe(&record[24], 4);
+            cpuid->xsaveCompactedSize = x64ReadLe(&record[28], 4);
+            break;
+        case X64_INFO_TAG_XSAVE_COMPONENT: {
+            const uint32_t index = x64ReadLe(record, 4);
+            if (index < X64_MAX_XSAVE_COMPONENTS) {
+                struct X64XsaveComponent* component = &cpuid->xsaveComponents[index];
+                component->size = x64ReadLe(&record[4], 4);
+                component->offset = x64ReadLe(&record[8], 4);
+                component->supervisor = record[12] != 0;
+                component->aligned = record[13] != 0;
+            }
+            break;
+        }
+        case X64_INFO_TAG_FREQUENCY:
+            cpuid->tscDenominator = x64ReadLe(record, 4);
+            cpuid->tscNumerator = x64ReadLe(&record[4], 4);
+            cpuid->crystalHz = x64ReadLe(&record[8], 4);
+            cpuid->hypervisorTscKhz = x64ReadLe(&record[12], 4);
+            cpuid->baseMhz = x64ReadLe(&record[16], 2);
+            cpuid->maxMhz = x64ReadLe(&record[18], 2);
+            cpuid->busMhz = x64ReadLe(&record[20], 2);
+            break;
+        case X64_INFO_TAG_AMD_TOPOLOGY:
+            cpuid->packageThreads = x64ReadLe(record, 4);
+            cpuid->extendedApicId = x64ReadLe(&record[4], 4);
+            cpuid->apicIdCoreIdSize = record[8];
+            cpuid->computeUnitId = record[9];
+            cpuid->threadsPerComputeUnit = record[10];
+            cpuid->nodeId = record[11];
+            cpuid->nodesPerPackage = record[12];
+            break;
+        }
+    }
+    return true;
+}